@@ -0,0 +1,712 @@
+#include <stdexcept>
+#include <iostream>
+#include <exception>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <sstream>
+#include <map>
+
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <tri_edge.h>
+#include <trimesh_io.h>
+#include <trimesh_dataset.h>
+#include <trimesh_mscomplex.h>
+#include <trimesh_order.h>
+
+using namespace std;
+namespace bpo = boost::program_options;
+
+/// \brief An n x n grid of vertices triangulated into 2(n-1)^2 tris
+/// \note  Tris are shuffled as scanned data seldom comes in a nice order
+void make_grid(int n, tri_cc_t::tri_idx_list_t &tlist,uint &nverts)
+{
+  tlist.clear();
+
+  for(int i = 0 ; i < n-1; ++i)
+    for(int j = 0 ; j < n-1; ++j)
+    {
+      uint a = i*n + j, b = a + 1, c = a + n, d = c + 1;
+
+      tlist.push_back(la::make_vec<uint>(a,b,d));
+      tlist.push_back(la::make_vec<uint>(a,d,c));
+    }
+
+  srand(0);
+  std::random_shuffle(tlist.begin(),tlist.end());
+
+  nverts = n*n;
+}
+
+/// \brief A random function over nverts vertices
+void make_fns(uint nverts, trimesh::fn_list_t &fns)
+{
+  fns.resize(nverts);
+
+  srand(0);
+
+  for(uint i = 0 ; i < nverts; ++i)
+    fns[i] = double(rand())/RAND_MAX;
+}
+
+/*===========================================================================*/
+
+/// \brief Uniform noise in [-a,a]
+inline double noise(double a) {return a*(2.0*rand()/RAND_MAX - 1.0);}
+
+/// \brief Tris of an nu x nv quad grid of verts u*nv + v. The grid wraps
+///        around in u and/or v if asked to.
+void add_quad_grid(int nu,int nv,bool wrap_u,bool wrap_v,uint vbase,
+                   tri_cc_t::tri_idx_list_t &tlist)
+{
+  int qu = (wrap_u)?(nu):(nu-1), qv = (wrap_v)?(nv):(nv-1);
+
+  for(int i = 0 ; i < qu; ++i)
+    for(int j = 0 ; j < qv; ++j)
+    {
+      uint a = vbase + i*nv + j,           b = vbase + i*nv + (j+1)%nv;
+      uint c = vbase + ((i+1)%nu)*nv + j,  d = vbase + ((i+1)%nu)*nv + (j+1)%nv;
+
+      tlist.push_back(la::make_vec<uint>(a,b,d));
+      tlist.push_back(la::make_vec<uint>(a,d,c));
+    }
+}
+
+/// \brief An n x n terrain: a few rolling hills plus noise
+void make_terrain(int n,double nz,trimesh::fn_list_t &fns,
+                  tri_cc_t::tri_idx_list_t &tlist)
+{
+  tlist.clear();
+  add_quad_grid(n,n,false,false,0,tlist);
+
+  fns.resize(n*n);
+
+  for(int i = 0 ; i < n; ++i)
+    for(int j = 0 ; j < n; ++j)
+    {
+      double x = 4*M_PI*i/n, y = 4*M_PI*j/n;
+
+      fns[i*n+j] = sin(x)*cos(y) + 0.5*sin(2.3*x + 1.7*y) + noise(nz);
+    }
+}
+
+typedef std::map<long,uint> pt_idx_map_t;
+
+/// \brief The vertex at lattice point (x,y,z), made on first use, with the
+///        height on the unit sphere as its function
+uint sphere_vert(int x,int y,int z,int n,pt_idx_map_t &pt_idx,
+                 trimesh::fn_list_t &fns)
+{
+  long k = (long(x+n)*(2*n+1) + (y+n))*(2*n+1) + (z+n);
+
+  pt_idx_map_t::iterator it = pt_idx.find(k);
+
+  if(it != pt_idx.end())
+    return it->second;
+
+  fns.push_back(double(z)/sqrt(double(x*x + y*y + z*z)));
+
+  return pt_idx[k] = fns.size() - 1;
+}
+
+/// \brief A closed sphere: an octahedron with each face split into n^2
+///        tris, so that no vertex has more than 6 neighbours. The function
+///        is the height plus noise.
+void make_sphere(int n,double nz,trimesh::fn_list_t &fns,
+                 tri_cc_t::tri_idx_list_t &tlist)
+{
+  pt_idx_map_t pt_idx;
+
+  tlist.clear();
+  fns.clear();
+
+  for(int o = 0 ; o < 8; ++o)
+  {
+    int sx = (o&1)?(-1):(1), sy = (o&2)?(-1):(1), sz = (o&4)?(-1):(1);
+
+    bool flip = (sx*sy*sz < 0);
+
+    for(int i = 0 ; i < n; ++i)
+      for(int j = 0 ; i + j < n; ++j)
+      {
+        int k = n - i - j;
+
+        uint a = sphere_vert(sx*i    ,sy*j    ,sz*k    ,n,pt_idx,fns);
+        uint b = sphere_vert(sx*(i+1),sy*j    ,sz*(k-1),n,pt_idx,fns);
+        uint c = sphere_vert(sx*i    ,sy*(j+1),sz*(k-1),n,pt_idx,fns);
+
+        tlist.push_back((flip)?(la::make_vec<uint>(a,c,b)):(la::make_vec<uint>(a,b,c)));
+
+        if(k < 2)
+          continue;
+
+        uint d = sphere_vert(sx*(i+1),sy*(j+1),sz*(k-2),n,pt_idx,fns);
+
+        tlist.push_back((flip)?(la::make_vec<uint>(b,c,d)):(la::make_vec<uint>(b,d,c)));
+      }
+  }
+
+  for(int i = 0 ; i < fns.size(); ++i)
+    fns[i] += noise(nz);
+}
+
+/// \brief A closed n x 2n torus, lying on its side. The function is the
+///        height plus noise.
+void make_torus(int n,double nz,trimesh::fn_list_t &fns,
+                tri_cc_t::tri_idx_list_t &tlist)
+{
+  int m = 2*n;
+
+  tlist.clear();
+  add_quad_grid(m,n,true,true,0,tlist);
+
+  fns.resize(m*n);
+
+  for(int i = 0 ; i < m; ++i)
+    for(int j = 0 ; j < n; ++j)
+    {
+      double u = 2*M_PI*i/m, v = 2*M_PI*j/n;
+
+      fns[i*n+j] = (2 + cos(v))*cos(u) + noise(nz);
+    }
+}
+
+/// \brief Make the named synthetic mesh
+/// \note  Verts and tris are shuffled as scanned data seldom comes in a nice
+///        order
+void make_mesh(const string &name,int n,double nz,trimesh::fn_list_t &fns,
+               tri_cc_t::tri_idx_list_t &tlist)
+{
+  srand(0);
+
+  if     (name == "terrain") make_terrain(n,nz,fns,tlist);
+  else if(name == "sphere")  make_sphere(n,nz,fns,tlist);
+  else if(name == "torus")   make_torus(n,nz,fns,tlist);
+  else ENSUREV(false,"unknown mesh",name);
+
+  std::vector<uint>  perm(fns.size());
+  trimesh::fn_list_t pfns(fns.size());
+
+  for(uint i = 0 ; i < perm.size(); ++i)
+    perm[i] = i;
+
+  std::random_shuffle(perm.begin(),perm.end());
+
+  for(uint i = 0 ; i < perm.size(); ++i)
+    pfns[perm[i]] = fns[i];
+
+  for(uint i = 0 ; i < tlist.size(); ++i)
+    for(uint j = 0 ; j < 3; ++j)
+      tlist[i][j] = perm[tlist[i][j]];
+
+  fns.swap(pfns);
+
+  std::random_shuffle(tlist.begin(),tlist.end());
+}
+
+/*===========================================================================*/
+
+/// \brief Timings of one benchmark stage over all runs
+struct stage_time_t
+{
+  string name;
+  double total;
+  double min;
+  int    runs;
+
+  stage_time_t(const string &n):name(n),total(0),min(0),runs(0){}
+
+  void add(double t)
+  {
+    min    = (runs == 0)?(t):(std::min(min,t));
+    total += t;
+    runs  += 1;
+  }
+
+  double mean() const {return (runs == 0)?(0):(total/runs);}
+};
+
+typedef std::vector<stage_time_t> stage_time_list_t;
+
+/// \brief What gets written to the json file for one benchmark
+struct bench_result_t
+{
+  string                         name;
+  std::vector<pair<string,long> > counts;
+  stage_time_list_t              stages;
+};
+
+void write_json(std::ostream &os,int num_threads,int num_runs,
+                const std::vector<bench_result_t> &res)
+{
+  os.precision(9);
+
+  os<<"{"<<endl;
+  os<<"  \"num_threads\": "<<num_threads<<","<<endl;
+  os<<"  \"num_runs\": "<<num_runs<<","<<endl;
+  os<<"  \"benchmarks\": ["<<endl;
+
+  for(int i = 0 ; i < res.size(); ++i)
+  {
+    os<<"    {"<<endl;
+    os<<"      \"name\": \""<<res[i].name<<"\","<<endl;
+
+    for(int j = 0 ; j < res[i].counts.size(); ++j)
+      os<<"      \""<<res[i].counts[j].first<<"\": "
+        <<res[i].counts[j].second<<","<<endl;
+
+    os<<"      \"stages\": {"<<endl;
+
+    for(int j = 0 ; j < res[i].stages.size(); ++j)
+    {
+      const stage_time_t &st = res[i].stages[j];
+
+      os<<"        \""<<st.name<<"\": {\"mean\": "<<st.mean()
+        <<", \"min\": "<<st.min<<"}"
+        <<((j+1 == res[i].stages.size())?(""):(","))<<endl;
+    }
+
+    os<<"      }"<<endl;
+    os<<"    }"<<((i+1 == res.size())?(""):(","))<<endl;
+  }
+
+  os<<"  ]"<<endl;
+  os<<"}"<<endl;
+}
+
+void print_result(std::ostream &os,const bench_result_t &res)
+{
+  os<<"------------------------------------"<<endl;
+  os<<res.name<<endl;
+
+  for(int j = 0 ; j < res.counts.size(); ++j)
+    os<<"  "<<res.counts[j].first<<" = "<<res.counts[j].second<<endl;
+
+  for(int j = 0 ; j < res.stages.size(); ++j)
+  {
+    string n = res.stages[j].name + " ";
+    n.resize(std::max<int>(n.size(),26),'-');
+    os<<"  "<<n<<" "<<res.stages[j].mean()<<endl;
+  }
+}
+
+/*===========================================================================*/
+
+/// \brief Time each stage of the pipeline on a synthetic mesh
+bench_result_t bench_pipeline(const string &mesh,int n,double nz,
+                              double simp_tresh,tri_cc_t::eTopology topo,
+                              trimesh::dataset_t::eGradient grad,bool reorder,
+                              int num_runs)
+{
+  using namespace trimesh;
+
+  fn_list_t      fns;
+  tri_idx_list_t tlist;
+
+  make_mesh(mesh,n,nz,fns,tlist);
+
+  stage_time_list_t st;
+  st.push_back(stage_time_t("reorder"));
+  st.push_back(stage_time_t("tri_cc_init"));
+  st.push_back(stage_time_t("compile_topology"));
+  st.push_back(stage_time_t("work"));
+  st.push_back(stage_time_t("simplify"));
+  st.push_back(stage_time_t("collect_mfolds"));
+  st.push_back(stage_time_t("save_bin"));
+  st.push_back(stage_time_t("load_bin"));
+  st.push_back(stage_time_t("mfold_encode"));
+  st.push_back(stage_time_t("mfold_decode"));
+  st.push_back(stage_time_t("first_mfold_lazy"));
+
+  long mfold_cells = 0,mfold_code_bytes = 0;
+
+  long num_cps = 0,num_cancs = 0,num_bytes = 0,topo_bytes = 0,ds_bytes = 0;
+
+  for(int r = 0 ; r < num_runs; ++r)
+  {
+    utl::timer t;
+
+    // the mesh is reordered on a copy so that every run starts from the
+    // same input. Mapping the cellids back is timed with the reordering.
+    fn_list_t      rfns(fns);
+    tri_idx_list_t rtlist(tlist);
+    mesh_order_t   order;
+    double         order_time = 0;
+
+    t.restart();
+    if(reorder)
+      order.reorder(rfns,rtlist);
+    order_time += t.elapsed();
+
+    t.restart();
+    tri_cc_ptr_t tcc(new tri_cc_t);
+    tcc->init(rtlist,rfns.size());
+    st[1].add(t.elapsed());
+
+    t.restart();
+    if(reorder)
+      order.map_cells(*tcc);
+    order_time += t.elapsed();
+
+    t.restart();
+    tcc->compile_topology(topo);
+    st[2].add(t.elapsed());
+
+    dataset_ptr_t   ds(new dataset_t(rfns,tcc));
+    mscomplex_ptr_t msc(new mscomplex_t);
+
+    ds->set_gradient(grad);
+
+    t.restart();
+    ds->work(msc);
+    st[3].add(t.elapsed());
+
+    t.restart();
+    if(reorder)
+      order.to_original(*msc);
+    order_time += t.elapsed();
+    st[0].add(order_time);
+
+    t.restart();
+    msc->simplify(simp_tresh,true);
+    st[4].add(t.elapsed());
+
+    // latency to the first max's des manifold with lazy traversal, to
+    // compare with collecting them all. Reordered cellids are left as is.
+    t.restart();
+    {
+      if(reorder)
+        order.to_reordered(*msc);
+
+      mfold_cache_t cache(msc,ds,1<<24);
+
+      for(int i = 0 ; i < msc->get_num_critpts(); ++i)
+        if(msc->is_not_paired(i) && msc->index(i) == 2)
+        {
+          cache.get(DES,i);
+          break;
+        }
+
+      if(reorder)
+        order.to_original(*msc);
+    }
+    st[10].add(t.elapsed());
+
+    t.restart();
+    if(reorder)
+      order.collect_mfolds(msc,ds);
+    else
+      msc->collect_mfolds(ds);
+    st[5].add(t.elapsed());
+
+    std::stringstream ss;
+
+    t.restart();
+    msc->save_bin(ss);
+    st[6].add(t.elapsed());
+
+    mscomplex_t msc2;
+
+    t.restart();
+    msc2.load_bin(ss);
+    st[7].add(t.elapsed());
+
+    ENSURE(msc2.get_num_critpts() == msc->get_num_critpts(),
+           "loaded a different mscomplex");
+
+    // manifolds are coded one after the other into one buffer, as save_msc
+    // does, and then decoded back one at a time
+    std::vector<uint8_t> code;
+    int_list_t           code_offs(1,0);
+    mfold_cells = 0;
+
+    t.restart();
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+      for(int i = 0 ; i < msc->m_mfolds[dir].size(); ++i)
+      {
+        const mfold_t &m = msc->m_mfolds[dir][i];
+        encode_mfold(m.data(),m.data() + m.size(),code);
+        code_offs.push_back(code.size());
+        mfold_cells += m.size();
+      }
+    st[8].add(t.elapsed());
+
+    mfold_t m;
+    m.reserve(mfold_cells);
+
+    // a single decode pass takes a few ms at most. So passes are repeated
+    // for at least 100ms, timed in us, and the mean pass time is recorded.
+    int  decode_passes = 0;
+    long decode_us     = 0;
+
+    t.restart();
+    do
+    {
+      m.clear();
+
+      for(int i = 0 ; i+1 < code_offs.size(); ++i)
+        decode_mfold(code.data() + code_offs[i],code.data() + code_offs[i+1],m);
+
+      ++decode_passes;
+      decode_us = t.elapsed_us();
+    }
+    while(decode_us < 100000);
+    st[9].add(double(decode_us)/decode_passes/1e6);
+
+    ENSURE(m.size() == mfold_cells,"decoded a different number of cells");
+
+    mfold_code_bytes = code.size();
+
+    num_cps   = msc->get_num_critpts();
+    num_cancs = msc->m_canc_list.size();
+    num_bytes  = ss.str().size();
+    topo_bytes = tcc->topology_bytes();
+    ds_bytes   = ds->state_bytes();
+  }
+
+  bench_result_t res;
+
+  res.name   = mesh;
+  res.stages = st;
+  res.counts.push_back(make_pair(string("size"),long(n)));
+  res.counts.push_back(make_pair(string("num_verts"),long(fns.size())));
+  res.counts.push_back(make_pair(string("num_tris"),long(tlist.size())));
+  res.counts.push_back(make_pair(string("num_cps"),num_cps));
+  res.counts.push_back(make_pair(string("num_cancs"),num_cancs));
+  res.counts.push_back(make_pair(string("msc_bytes"),num_bytes));
+  res.counts.push_back(make_pair(string("mfold_bytes"),long(mfold_cells*sizeof(cellid_t))));
+  res.counts.push_back(make_pair(string("mfold_code_bytes"),mfold_code_bytes));
+  res.counts.push_back(make_pair(string("mfold_decode_cells_per_s"),
+                                 (st[9].mean() > 0)?(long(mfold_cells/st[9].mean())):(0L)));
+  res.counts.push_back(make_pair(string("topology"),long(topo)));
+  res.counts.push_back(make_pair(string("topology_bytes"),topo_bytes));
+  res.counts.push_back(make_pair(string("dataset_bytes"),ds_bytes));
+  res.counts.push_back(make_pair(string("gradient"),long(grad)));
+  res.counts.push_back(make_pair(string("reorder"),long(reorder)));
+
+  return res;
+}
+
+/*===========================================================================*/
+
+void write_off_file(const string &f,const trimesh::fn_list_t &fns,
+                    const tri_cc_t::tri_idx_list_t &tlist)
+{
+  fstream fs(f.c_str(),ios::out);
+
+  ENSUREV(fs.is_open(),"unable to open file for writing",f);
+
+  fs<<"OFF"<<endl;
+  fs<<fns.size()<<" "<<tlist.size()<<" 0"<<endl;
+
+  fs.precision(17);
+
+  for(int i = 0 ; i < fns.size(); ++i)
+    fs<<fns[i]<<" 0 0 "<<fns[i]<<endl;
+
+  for(int i = 0 ; i < tlist.size(); ++i)
+    fs<<"3 "<<tlist[i][0]<<" "<<tlist[i][1]<<" "<<tlist[i][2]<<endl;
+}
+
+bool is_same_tcc(const tri_cc_t &a,const tri_cc_t &b)
+{
+  if(a.m_verts != b.m_verts || a.m_edges != b.m_edges ||
+     a.m_tris.size() != b.m_tris.size())
+    return false;
+
+  for(int i = 0 ; i < a.m_tris.size(); ++i)
+    if(a.m_tris[i].v     != b.m_tris[i].v ||
+       a.m_tris[i].e     != b.m_tris[i].e ||
+       a.m_tris[i].fnext != b.m_tris[i].fnext)
+      return false;
+
+  return true;
+}
+
+/// \brief Time the edge builders and the mesh readers on a grid
+bench_result_t bench_io(int grid_size,int num_runs,const string &tmp_pfx)
+{
+  tri_cc_t::tri_idx_list_t tlist;
+  uint                     nverts;
+
+  make_grid(grid_size,tlist,nverts);
+
+  stage_time_list_t st;
+  st.push_back(stage_time_t("tri_cc_init_sort"));
+  st.push_back(stage_time_t("tri_cc_init_map"));
+  st.push_back(stage_time_t("read_off_file_split"));
+  st.push_back(stage_time_t("read_off_file"));
+  st.push_back(stage_time_t("read_mesh_bin"));
+
+  for(int r = 0 ; r < num_runs; ++r)
+  {
+    tri_cc_t tcc_sort,tcc_map;
+
+    utl::timer t;
+    tcc_sort.init(tlist,nverts);
+    st[0].add(t.elapsed());
+
+    t.restart();
+    tcc_map.init_edge_map(tlist,nverts);
+    st[1].add(t.elapsed());
+
+    ENSURE(is_same_tcc(tcc_sort,tcc_map),"edge builders disagree");
+  }
+
+  trimesh::fn_list_t fns;
+  make_fns(nverts,fns);
+
+  string off_file = tmp_pfx + ".off", mesh_file = tmp_pfx + ".mesh.bin";
+
+  write_off_file(off_file,fns,tlist);
+  trimesh::write_mesh_bin(mesh_file,fns,tlist);
+
+  for(int r = 0 ; r < num_runs; ++r)
+  {
+    trimesh::fn_list_t       fns_split,fns_off,fns_mbin;
+    tri_cc_t::tri_idx_list_t tl_split,tl_off,tl_mbin;
+
+    utl::timer t;
+    trimesh::read_off_file_split(off_file,fns_split,tl_split,3);
+    st[2].add(t.elapsed());
+
+    t.restart();
+    trimesh::read_off_file(off_file,fns_off,tl_off,3);
+    st[3].add(t.elapsed());
+
+    t.restart();
+    trimesh::read_mesh_bin(mesh_file,fns_mbin,tl_mbin);
+    st[4].add(t.elapsed());
+
+    ENSURE(fns_split == fns && fns_off == fns && fns_mbin == fns,
+           "mesh readers disagree on the function");
+    ENSURE(tl_split == tlist && tl_off == tlist && tl_mbin == tlist,
+           "mesh readers disagree on the tris");
+  }
+
+  std::remove(off_file.c_str());
+  std::remove(mesh_file.c_str());
+
+  bench_result_t res;
+
+  res.name   = "io";
+  res.stages = st;
+  res.counts.push_back(make_pair(string("size"),long(grid_size)));
+  res.counts.push_back(make_pair(string("num_verts"),long(nverts)));
+  res.counts.push_back(make_pair(string("num_tris"),long(tlist.size())));
+
+  return res;
+}
+
+/*===========================================================================*/
+
+int main(int ac , char **av)
+{
+  int    mesh_size   = 300;
+  int    io_size     = 0;
+  int    num_runs    = 3;
+  int    num_threads = 0;
+  double fn_noise    = 0.1;
+  double simp_tresh  = 0.05;
+  string meshes;
+  string topology;
+  string gradient;
+  string json_file;
+  string tmp_pfx;
+  bool   reorder     = false;
+
+  bpo::options_description desc("Allowed options");
+  desc.add_options()
+      ("help,h", "produce help message")
+      ("meshes",bpo::value(&meshes)->default_value("terrain,sphere,torus"),
+       "comma separated synthetic meshes to run the pipeline on\n"\
+       "terrain : n x n height field\n"\
+       "sphere  : closed octahedral sphere, 8n^2 tris\n"\
+       "torus   : closed 2n x n torus")
+      ("mesh-size,n",bpo::value(&mesh_size)->default_value(300),
+       "size n of the synthetic meshes")
+      ("noise",bpo::value(&fn_noise)->default_value(0.1),
+       "amplitude of the noise added to the function")
+      ("simp-tresh,s",bpo::value(&simp_tresh)->default_value(0.05),
+       "normalized persistence treshold to simplify to")
+      ("topology",bpo::value(&topology)->default_value("half-edge"),
+       "precomputed topology tables: half-edge, edges or full")
+      ("gradient",bpo::value(&gradient)->default_value("passes"),
+       "how the discrete gradient is computed: passes or lower-star")
+      ("reorder",bpo::bool_switch(&reorder),
+       "renumber the verts and tris for locality before the gradient")
+      ("io-size",bpo::value(&io_size)->default_value(0),
+       "also time the edge builders and mesh readers on an n x n grid\n"\
+       "(0 = don't)")
+      ("num-runs,r",bpo::value(&num_runs)->default_value(3),
+       "number of timed runs of each stage")
+      ("num-threads",bpo::value(&num_threads)->default_value(0),
+       "number of threads to use (0 = all cores)")
+      ("json,j",bpo::value(&json_file)->default_value(""),
+       "write the timings to this json file (- for stdout)")
+      ("tmp-prefix",bpo::value(&tmp_pfx)->default_value("/tmp/mscomplex-tri-bench"),
+       "prefix of the temporary files written by the load benchmarks")
+      ;
+
+  bpo::variables_map vm;
+  bpo::store(bpo::parse_command_line(ac, av, desc), vm);
+  bpo::notify(vm);
+
+  if (vm.count("help"))
+  {
+    cout << desc << endl;
+    return 0;
+  }
+
+  ENSUREV(num_runs > 0,"need at least one run",num_runs);
+
+  utl::set_num_threads(num_threads);
+
+  // json to stdout goes alone
+  std::ostream &log = (json_file == "-")?(cerr):(cout);
+
+  std::vector<string> mesh_names;
+  boost::algorithm::split(mesh_names,meshes,boost::algorithm::is_any_of(","),
+                          boost::algorithm::token_compress_on);
+
+  std::vector<bench_result_t> res;
+
+  log<<"===================================="<<endl;
+  log<<"num threads = "<<utl::get_num_threads()<<endl;
+
+  for(int i = 0 ; i < mesh_names.size(); ++i)
+  {
+    if(mesh_names[i].empty())
+      continue;
+
+    res.push_back(bench_pipeline(mesh_names[i],mesh_size,fn_noise,simp_tresh,
+                                 tri_cc_t::topology_from_string(topology),
+                                 trimesh::dataset_t::gradient_from_string(gradient),
+                                 reorder,num_runs));
+
+    print_result(log,res.back());
+  }
+
+  if(io_size > 0)
+  {
+    res.push_back(bench_io(io_size,num_runs,tmp_pfx));
+
+    print_result(log,res.back());
+  }
+
+  log<<"===================================="<<endl;
+
+  if(json_file == "-")
+    write_json(cout,utl::get_num_threads(),num_runs,res);
+  else if(!json_file.empty())
+  {
+    fstream fs(json_file.c_str(),ios::out);
+    ENSUREV(fs.is_open(),"unable to open file for writing",json_file);
+    write_json(fs,utl::get_num_threads(),num_runs,res);
+  }
+}
@@ -9,6 +9,9 @@
 #include <trimesh_dataset.h>
 #include <trimesh_mscomplex.h>
 #include <trimesh_mscomplex_simp.h>
+#include <trimesh_io.h>
+#include <trimesh_partition.h>
+#include <trimesh_order.h>
 
 using namespace std;
 namespace bpo = boost::program_options;
@@ -17,8 +20,10 @@ typedef float bin_data_type_t;
 
 const   uint bin_fnname_max_size = 32;
 
+/// \brief Read the listed comps (all if comps is empty) in one pass
 template <typename T>
-void read_bin_file(std::vector<T> &fns, const string & fname,int compno)
+void read_bin_comps(std::vector<std::vector<T> > &fns, const string & fname,
+                    trimesh::int_list_t &comps)
 {
   fstream fnfile ( fname.c_str(), fstream::in | fstream::binary );
 
@@ -29,24 +34,47 @@ void read_bin_file(std::vector<T> &fns, const string & fname,int compno)
   fnfile.read ( reinterpret_cast<char *> ( &num_bin_values ), sizeof ( int ) );
   fnfile.read ( reinterpret_cast<char *> ( &num_bin_comps ), sizeof ( int ) );
 
-  fns.resize(num_bin_values,-1);
+  if(comps.size() == 0)
+    for(int j = 0 ; j < num_bin_comps; ++j)
+      comps.push_back(j);
+
+  for(int j = 0 ; j < comps.size(); ++j)
+    ENSUREV(is_in_range(comps[j],0,num_bin_comps),"invalid component number",
+            comps[j]);
 
   fnfile.seekg ( bin_fnname_max_size*num_bin_comps, ios::cur );
-  fnfile.seekg ( sizeof ( bin_data_type_t ) * compno, ios::cur );
 
-  for ( uint i = 0; i < ( uint ) num_bin_values; i++ )
-  {
-    bin_data_type_t data;
+  // values are stored interleaved by component. Read them all in one go.
+  std::vector<bin_data_type_t> data(size_t(num_bin_values)*num_bin_comps);
 
-    fnfile.read ( reinterpret_cast<char *> ( &data ),sizeof(bin_data_type_t));
-    fnfile.seekg ( sizeof ( bin_data_type_t)*( num_bin_comps-1), ios::cur );
+  fnfile.read ( reinterpret_cast<char *> ( data.data() ),
+                data.size()*sizeof(bin_data_type_t));
 
-    fns[i] = data;
+  ENSURE(fnfile,"ran out of data when reading bin file");
+
+  fns.resize(comps.size());
+
+  for(int j = 0 ; j < comps.size(); ++j)
+  {
+    fns[j].resize(num_bin_values,-1);
+
+    for ( uint i = 0; i < ( uint ) num_bin_values; i++ )
+      fns[j][i] = data[size_t(i)*num_bin_comps + comps[j]];
   }
 
   fnfile.close();
 }
 
+template <typename T>
+void read_bin_file(std::vector<T> &fns, const string & fname,int compno)
+{
+  trimesh::int_list_t comps(1,compno);
+  std::vector<std::vector<T> > comp_fns;
+
+  read_bin_comps(comp_fns,fname,comps);
+  fns.swap(comp_fns[0]);
+}
+
 void print_bin_info(const string & fname)
 {
   fstream fnfile ( fname.c_str(), fstream::in | fstream::binary );
@@ -122,9 +150,7 @@ void read_tri_vlist( const char *filename,tri_cc_geom_t::vertex_list_t &vlist)
 
 namespace ba = boost::algorithm;
 
-template <typename T>
-void read_off_file(const string & fname, std::vector<T> &fns,
-                   trimesh::tri_idx_list_t &tlist ,int compno)
+void read_off_vlist(const string & fname, tri_cc_geom_t::vertex_list_t &vlist)
 {
   fstream off_file ( fname.c_str(), fstream::in);
 
@@ -140,81 +166,194 @@ void read_off_file(const string & fname, std::vector<T> &fns,
   ba::split(strs,ln,ba::is_any_of("\t \n"));
 
   int num_v = atoi(strs[0].c_str());
-  int num_t = atoi(strs[1].c_str());
-
-  fns.resize(num_v);
-  tlist.resize(num_t);
+  vlist.resize(num_v);
 
   for ( uint i = 0; i < num_v; ++i )
   {
     getline(off_file,ln);
     ba::split(strs,ln,ba::is_any_of("\t \n"));
-    fns[i] = atof(strs[compno].c_str());
 
-    ENSURE(is_in_range(compno,0,strs.size()),
-           "too few components in vinfo line");
+    vlist[i][0] = atof(strs[0].c_str());
+    vlist[i][1] = atof(strs[1].c_str());
+    vlist[i][2] = atof(strs[2].c_str());
   }
 
-  for ( uint i = 0; i < num_t; i++ )
-  {
-    getline(off_file,ln);
-    ba::split(strs,ln,ba::is_any_of("\t \n"));
+  off_file.close();
+}
+
 
-    int ntv     = atoi(strs[0].c_str());
-    tlist[i][0] = atoi(strs[1].c_str());
-    tlist[i][1] = atoi(strs[2].c_str());
-    tlist[i][2] = atoi(strs[3].c_str());
+/// \brief Save msc in the given output format
+/// \note  The gradient of ds is saved too, if ds is given (msc formats only)
+inline void save_msc(trimesh::mscomplex_ptr_t msc,const string &f,
+                     const string &out_fmt,
+                     trimesh::dataset_ptr_t ds=trimesh::dataset_ptr_t())
+{
+  if(out_fmt == "msc-varint")
+    msc->save_msc(f,true,ds);
+  else if(out_fmt == "msc")
+    msc->save_msc(f,false,ds);
+  else
+    msc->save(f);
+}
+
+/// \brief Write the dense manifold labels of the cells of ds
+/// \note  If reorder is set, ds is of the reordered mesh and msc is in the
+///        original numbering.
+void save_labels(trimesh::mscomplex_ptr_t msc,trimesh::dataset_ptr_t ds,
+                 const trimesh::mesh_order_t &order,bool reorder,
+                 const string &f)
+{
+  using namespace trimesh;
 
-    ENSURE(ntv == 3,"Mesh contains non-triangle polys");
-    ENSURE(is_in_range(tlist[i][0],0,num_v),"invalid index in file");
-    ENSURE(is_in_range(tlist[i][1],0,num_v),"invalid index in file");
-    ENSURE(is_in_range(tlist[i][2],0,num_v),"invalid index in file");
+  const int dir[] = {ASC,DES,ASC,DES}, dim[] = {0,1,1,2};
+
+  int_list_t l[4];
+
+  if(reorder)
+    order.to_reordered(*msc);
+
+  for(int i = 0 ; i < 4; ++i)
+    msc->get_mfold_labels(eGDIR(dir[i]),dim[i],ds,l[i]);
+
+  if(reorder)
+  {
+    order.to_original(*msc);
+
+    for(int i = 0 ; i < 4; ++i)
+      order.to_original_labels(dim[i],l[i]);
   }
 
-  off_file.close();
+  write_labels_bin(f,l[0],l[1],l[2],l[3]);
 }
 
-void read_off_vlist(const string & fname, tri_cc_geom_t::vertex_list_t &vlist)
+/// \brief Compute and save a complex for each of comp_fns over one tri_cc_t
+///
+/// \note Fields are worked concurrently, one per thread, each with its own
+///       dataset_t that is freed once the field is saved. The omp loops
+///       inside each field then run on that one thread.
+///
+/// \returns the number of fields that failed
+int work_batch(std::vector<trimesh::fn_list_t> &comp_fns,
+               const trimesh::int_list_t &comps,
+               trimesh::tri_idx_list_t &tlist,const string &fn_pfx,
+               const string &topology,const string &gradient,
+               bool reorder,double simp_tresh,
+               const string &out_fmt,bool labels,bool save_grad,
+               utl::timer &t)
 {
-  fstream off_file ( fname.c_str(), fstream::in);
+  int n = comp_fns.size();
 
-  ENSURE(off_file.is_open(),"unable to open off file");
+  trimesh::mesh_order_t order;
 
-  string ln;
-  std::vector<string> strs;
+  if(reorder)
+  {
+    order.reorder(comp_fns[0],tlist);
 
-  getline(off_file,ln);
-  ENSURE(ln=="OFF","Doesn't seem to be an OFF FILE");
+    for(int k = 1 ; k < n; ++k)
+      order.reorder_fns(comp_fns[k]);
 
-  getline(off_file,ln);
-  ba::split(strs,ln,ba::is_any_of("\t \n"));
+    cout<<"mesh reordered ----------- "<<t.elapsed()<<endl;
+  }
 
-  int num_v = atoi(strs[0].c_str());
-  vlist.resize(num_v);
+  tri_cc_ptr_t tcc(new tri_cc_t);
+  tcc->init(tlist,comp_fns[0].size());
 
-  for ( uint i = 0; i < num_v; ++i )
+  if(reorder)
+    order.map_cells(*tcc);
+
+  if(topology != "half-edge")
+    tcc->compile_topology(tri_cc_t::topology_from_string(topology));
+
+  cout<<"topology built ----------- "<<t.elapsed()<<endl;
+
+  std::vector<string> errs(n);
+
+#pragma omp parallel for schedule(dynamic,1)
+  for(int k = 0 ; k < n; ++k)
   {
-    getline(off_file,ln);
-    ba::split(strs,ln,ba::is_any_of("\t \n"));
+    try
+    {
+      string pfx = fn_pfx + ".c" + utl::to_string(comps[k]);
 
-    vlist[i][0] = atof(strs[0].c_str());
-    vlist[i][1] = atof(strs[1].c_str());
-    vlist[i][2] = atof(strs[2].c_str());
+      trimesh::dataset_ptr_t   ds(new trimesh::dataset_t(comp_fns[k],tcc));
+      trimesh::mscomplex_ptr_t msc(new trimesh::mscomplex_t);
+
+      ds->set_gradient(trimesh::dataset_t::gradient_from_string(gradient));
+
+      ds->work(msc);
+
+      if(reorder)
+        order.to_original(*msc);
+
+      msc->simplify(0.0);
+
+      if(reorder)
+        order.collect_mfolds(msc,ds);
+      else
+        msc->collect_mfolds(ds);
+
+      trimesh::dataset_ptr_t grad_ds = (save_grad)?(ds):(trimesh::dataset_ptr_t());
+
+      save_msc(msc,pfx+".mscomplex.full.bin",out_fmt,grad_ds);
+
+      msc->simplify(simp_tresh);
+
+      if(reorder)
+        order.collect_mfolds(msc,ds);
+      else
+        msc->collect_mfolds(ds);
+
+      save_msc(msc,pfx+".mscomplex.bin",out_fmt,grad_ds);
+
+      if(labels)
+        save_labels(msc,ds,order,reorder,pfx+".labels.bin");
+    }
+    catch(std::exception &e)
+    {
+      errs[k] = e.what();
+    }
+
+    trimesh::fn_list_t().swap(comp_fns[k]);
+
+#pragma omp critical(batch_log)
+    cout<<"comp "<<comps[k]<<((errs[k].empty())?(" done "):(" FAILED "))
+        <<"------------ "<<t.elapsed()<<endl;
   }
 
-  off_file.close();
-}
+  int num_failed = 0;
+
+  for(int k = 0 ; k < n; ++k)
+    if(!errs[k].empty())
+    {
+      cout<<"comp "<<comps[k]<<" : "<<errs[k]<<endl;
+      ++num_failed;
+    }
 
+  return num_failed;
+}
 
 int main(int ac , char **av)
 {
   string tri_filename;
   string bin_filename;
   string off_filename;
+  string mesh_filename;
+  string save_mesh_filename;
   string simp_method;
+  string topology;
+  string gradient;
+  string comps_str;
+  string out_fmt;
 
   int    comp_no = 0;
+  int    num_threads = 0;
+  int    num_blocks  = 0;
+  int    num_rings   = 3;
+  int    num_procs   = 0;
   double simp_tresh  = 0.0;
+  bool   reorder     = false;
+  bool   labels      = false;
+  bool   save_grad   = false;
 
   bpo::options_description desc("Allowed options");
   desc.add_options()
@@ -225,8 +364,17 @@ int main(int ac , char **av)
        "bin file name (function file)")
       ("off-file,o",bpo::value(&off_filename)->default_value(""),
        "off file name")
+      ("mesh-bin-file,m",bpo::value(&mesh_filename)->default_value(""),
+       "binary mesh file name (function and tris)")
+      ("save-mesh-bin",bpo::value(&save_mesh_filename)->default_value(""),
+       "save the input function and tris as a binary mesh file")
       ("comp-no,c",bpo::value(&comp_no)->default_value(0),
        "scalar component number to use for the MS compelex")
+      ("comps",bpo::value(&comps_str)->default_value(""),
+       "batch mode: work each of these comps (\"all\" or a comma\n"\
+       "separated list) over one shared mesh. Outputs are named\n"\
+       "<input>.c<comp>.mscomplex[.full].bin\n"\
+       "(\"all\" needs a tri-bin input)")
       ("simp-tresh,s",bpo::value(&simp_tresh)->default_value(0.0),
        "simplification treshold\n"\
        "\n"\
@@ -240,7 +388,46 @@ int main(int ac , char **av)
        "P  ----> Persistence\n"\
 //       "AWP ---> Area weighted persistence\n"\
 //       "ABP ---> Area before persistence"
-       );
+       )
+      ("out-format",bpo::value(&out_fmt)->default_value("boost"),
+       "format of the output mscomplex files\n"\
+       "boost : boost binary archive of the whole complex\n"\
+       "msc   : sectioned file that can be mmapped and read\n"\
+       "        one cp at a time (see mscomplex_view_t)\n"\
+       "msc-varint : msc with delta varint coded manifolds")
+      ("num-threads,n",bpo::value(&num_threads)->default_value(0),
+       "number of threads to use (0 = all cores)")
+      ("topology",bpo::value(&topology)->default_value("half-edge"),
+       "precomputed mesh topology tables.. more memory, faster queries\n"\
+       "half-edge : none\n"\
+       "edges     : edge->vert, edge->tri and tri->edge\n"\
+       "full      : edges + vert->edge and vert->tri")
+      ("gradient",bpo::value(&gradient)->default_value("passes"),
+       "how the discrete gradient is computed\n"\
+       "passes     : max facets, then pairs of each dim over all cells\n"\
+       "lower-star : each vert's lower star on its own (ProcessLowerStars)")
+      ("reorder",bpo::bool_switch(&reorder),
+       "renumber verts and tris for locality before the gradient is\n"\
+       "computed. Outputs use the input numbering.")
+      ("labels",bpo::bool_switch(&labels),
+       "also write <input>.labels.bin: for each vert, edge and tri, the\n"\
+       "surviving cp whose manifold holds it (see trimesh_io.h)")
+      ("save-gradient",bpo::bool_switch(&save_grad),
+       "also save the gradient in the msc files, so that manifolds can be\n"\
+       "collected again after a load (msc out-formats only)")
+      ("num-blocks,k",bpo::value(&num_blocks)->default_value(0),
+       "split the mesh-bin file into this many blocks of tris and work\n"\
+       "them one at a time (0 = work the whole mesh in-core).\n"\
+       "Manifolds are not computed in this mode. A vert to tri index of\n"\
+       "the mesh is kept next to it in <mesh-bin>.vtri.")
+      ("ghost-rings",bpo::value(&num_rings)->default_value(3),
+       "rings of ghost tris around each block. At least 2 for the passes\n"\
+       "gradient, as a pair may depend on verts two rings out, and at least\n"\
+       "1 for lower-star")
+      ("num-procs",bpo::value(&num_procs)->default_value(0),
+       "work the blocks in this many worker processes\n"\
+       "(0 = use threads in this process)")
+      ;
 
   bpo::variables_map vm;
   bpo::store(bpo::parse_command_line(ac, av, desc), vm);
@@ -261,13 +448,70 @@ int main(int ac , char **av)
     return 1;
   }
 
-  if((tri_filename.empty() || bin_filename.empty()) && off_filename.empty())
+  if((tri_filename.empty() || bin_filename.empty()) && off_filename.empty()
+     && mesh_filename.empty())
+  {
+    cout<<"Must specify either tri-bin, off or mesh-bin file"<<endl;
+    cout<<desc<<endl;
+    return 1;
+  }
+
+  if(num_blocks > 0 && labels)
+  {
+    cout<<"labels are not computed with num-blocks"<<endl;
+    cout<<desc<<endl;
+    return 1;
+  }
+
+  if(save_grad && (num_blocks > 0 || reorder || out_fmt == "boost"))
   {
-    cout<<"Must specify either tri-bin or off file"<<endl;
+    cout<<"save-gradient needs an msc out-format and is not done with "
+        <<"num-blocks or reorder"<<endl;
     cout<<desc<<endl;
     return 1;
   }
 
+  if(num_blocks > 0 && mesh_filename.empty())
+  {
+    cout<<"num-blocks needs a mesh-bin file"<<endl;
+    cout<<desc<<endl;
+    return 1;
+  }
+
+  if(out_fmt != "boost" && out_fmt != "msc" && out_fmt != "msc-varint")
+  {
+    cout<<"unknown out-format "<<out_fmt<<endl;
+    cout<<desc<<endl;
+    return 1;
+  }
+
+  if(!comps_str.empty() && (num_blocks > 0 || !mesh_filename.empty()))
+  {
+    cout<<"comps needs a tri-bin or off file"<<endl;
+    cout<<desc<<endl;
+    return 1;
+  }
+
+  trimesh::int_list_t comps;
+
+  if(!comps_str.empty() && comps_str != "all")
+  {
+    std::vector<string> strs;
+    ba::split(strs,comps_str,ba::is_any_of(","));
+
+    for(int i = 0 ; i < strs.size(); ++i)
+      comps.push_back(atoi(strs[i].c_str()));
+  }
+
+  if(comps_str == "all" && !off_filename.empty())
+  {
+    cout<<"comps=all needs a tri-bin file"<<endl;
+    cout<<desc<<endl;
+    return 1;
+  }
+
+  utl::set_num_threads(num_threads);
+
   utl::timer t;
   t.restart();
 
@@ -277,34 +521,131 @@ int main(int ac , char **av)
 
   trimesh::tri_idx_list_t tlist;
   trimesh::fn_list_t      fns;
-  cout<<"selected comp = "<<comp_no<<endl;
+
+  if(comps_str.empty())
+    cout<<"selected comp = "<<comp_no<<endl;
+  else
+    cout<<"selected comps= "<<comps_str<<endl;
+
+  cout<<"num threads   = "<<utl::get_num_threads()<<endl;
   cout<<"------------------------------------"<<endl;
 
   string fn_pfx;
 
-  if(off_filename.empty())
+  if(!comps_str.empty())
   {
-    print_bin_info(bin_filename);
-    read_tri_tlist(tri_filename.c_str(),tlist);
-    read_bin_file(fns,bin_filename,comp_no);
-    fn_pfx = tri_filename;
+    std::vector<trimesh::fn_list_t> comp_fns;
+
+    if(off_filename.empty())
+    {
+      print_bin_info(bin_filename);
+      read_tri_tlist(tri_filename.c_str(),tlist);
+      read_bin_comps(comp_fns,bin_filename,comps);
+      fn_pfx = tri_filename;
+    }
+    else
+    {
+      trimesh::read_off_file(off_filename,comp_fns,tlist,comps);
+
+      fn_pfx = off_filename;
+    }
+    cout<<"data read ---------------- "<<t.elapsed()<<endl;
+
+    int num_failed = work_batch(comp_fns,comps,tlist,fn_pfx,topology,gradient,
+                                reorder,simp_tresh,out_fmt,labels,
+                                save_grad,t);
+
+    cout<<"------------------------------------"<<endl;
+    cout<<"        Finished Processing         "<<endl;
+    cout<<"===================================="<<endl;
+
+    return (num_failed == 0)?(0):(1);
   }
-  else
+
+  trimesh::dataset_ptr_t   ds;
+  trimesh::mesh_order_t    order;
+  trimesh::mscomplex_ptr_t msc(new trimesh::mscomplex_t);
+
+  if(num_blocks > 0)
   {
-    read_off_file(off_filename,fns,tlist,comp_no);
-    fn_pfx = off_filename;
+    trimesh::mesh_bin_view_t mesh(mesh_filename);
+    fn_pfx = mesh_filename;
+    cout<<"num blocks    = "<<num_blocks<<endl;
+    cout<<"data mapped -------------- "<<t.elapsed()<<endl;
+
+    trimesh::partition_t part(mesh,num_blocks,num_rings,
+        trimesh::dataset_t::gradient_from_string(gradient));
+
+    if(num_procs > 0)
+      part.work_procs(msc,num_procs);
+    else
+      part.work(msc);
+
+    cout<<"gradient done ------------ "<<t.elapsed()<<endl;
   }
-  cout<<"data read ---------------- "<<t.elapsed()<<endl;
+  else
+  {
+    if(!mesh_filename.empty())
+    {
+      trimesh::read_mesh_bin(mesh_filename,fns,tlist);
+      fn_pfx = mesh_filename;
+    }
+    else if(off_filename.empty())
+    {
+      print_bin_info(bin_filename);
+      read_tri_tlist(tri_filename.c_str(),tlist);
+      read_bin_file(fns,bin_filename,comp_no);
+      fn_pfx = tri_filename;
+    }
+    else
+    {
+      trimesh::read_off_file(off_filename,fns,tlist,comp_no);
+      fn_pfx = off_filename;
+    }
+    cout<<"data read ---------------- "<<t.elapsed()<<endl;
 
-  trimesh::dataset_ptr_t   ds(new trimesh::dataset_t(fns,tlist));
-  trimesh::mscomplex_ptr_t msc(new trimesh::mscomplex_t);
-  ds->work(msc);
-  cout<<"gradient done ------------ "<<t.elapsed()<<endl;
+    if(!save_mesh_filename.empty())
+    {
+      trimesh::write_mesh_bin(save_mesh_filename,fns,tlist);
+      cout<<"mesh bin written --------- "<<t.elapsed()<<endl;
+    }
+
+    if(reorder)
+    {
+      order.reorder(fns,tlist);
+      cout<<"mesh reordered ----------- "<<t.elapsed()<<endl;
+    }
+
+    ds.reset(new trimesh::dataset_t(fns,tlist));
+
+    if(reorder)
+      order.map_cells(*ds->m_tcc);
+
+    if(topology != "half-edge")
+    {
+      ds->m_tcc->compile_topology(tri_cc_t::topology_from_string(topology));
+      cout<<"topology compiled -------- "<<t.elapsed()<<endl;
+    }
+
+    ds->set_gradient(trimesh::dataset_t::gradient_from_string(gradient));
+    ds->work(msc);
+
+    if(reorder)
+      order.to_original(*msc);
+
+    cout<<"gradient done ------------ "<<t.elapsed()<<endl;
+  }
 
   msc->simplify(0.0);
-  msc->collect_mfolds(ds);
 
-  msc->save(fn_pfx+".mscomplex.full.bin");
+  if(ds && reorder)
+    order.collect_mfolds(msc,ds);
+  else if(ds)
+    msc->collect_mfolds(ds);
+
+  trimesh::dataset_ptr_t grad_ds = (save_grad)?(ds):(trimesh::dataset_ptr_t());
+
+  save_msc(msc,fn_pfx+".mscomplex.full.bin",out_fmt,grad_ds);
   cout<<"write unsimplified done -- "<<t.elapsed()<<endl;
 
 
@@ -333,10 +674,20 @@ int main(int ac , char **av)
 
   cout<<"simplification done ------ "<<t.elapsed()<<endl;
 
-  msc->collect_mfolds(ds);
-  msc->save(fn_pfx+".mscomplex.bin");
+  if(ds && reorder)
+    order.collect_mfolds(msc,ds);
+  else if(ds)
+    msc->collect_mfolds(ds);
+
+  save_msc(msc,fn_pfx+".mscomplex.bin",out_fmt,grad_ds);
   cout<<"write simplified done ---- "<<t.elapsed()<<endl;
 
+  if(labels)
+  {
+    save_labels(msc,ds,order,reorder,fn_pfx+".labels.bin");
+    cout<<"write labels done -------- "<<t.elapsed()<<endl;
+  }
+
   cout<<"------------------------------------"<<endl;
   cout<<"        Finished Processing         "<<endl;
   cout<<"===================================="<<endl;
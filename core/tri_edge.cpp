@@ -27,6 +27,7 @@
 #include <cstring>
 #include <algorithm>
 #include <stdexcept>
+#include <stdint.h>
 
 
 #include <utl.h>
@@ -36,7 +37,7 @@ using namespace std;
 
 const uint tri_cc_t::INVALID_VALUE = 0xffffffff;
 
-tri_cc_t::tri_cc_t(){}
+tri_cc_t::tri_cc_t():m_topo(TOPO_HALF_EDGE){}
 
 tri_cc_t::~tri_cc_t(){clear();}
 
@@ -60,11 +61,148 @@ bool operator()(const edge_t &a,const edge_t &b) const
 }
 };
 
-void tri_cc_t::init(const tri_idx_list_t &tlist,const uint & N)
+/// \brief LSD radix sort of (key,val) pairs on the 64 bit keys.
+/// \note  16 bit digits. Passes whose digit is the same for all keys are
+///        skipped. So small meshes pay for just the bits that are used.
+void radix_sort(vector<uint64_t> &keys, vector<uint> &vals)
+{
+  const int nbits = 16, nbkts = 1<<nbits, npass = 64/nbits;
+
+  int n = keys.size();
+
+  vector<int> cts(npass*nbkts,0);
+
+  for(int i = 0 ; i < n; ++i)
+    for(int p = 0 ; p < npass; ++p)
+      cts[p*nbkts + ((keys[i] >> (p*nbits))&(nbkts-1))]++;
+
+  vector<uint64_t> tkeys(n);
+  vector<uint>     tvals(n);
+
+  for(int p = 0 ; p < npass; ++p)
+  {
+    int *pcts = cts.data() + p*nbkts;
+
+    if(*std::max_element(pcts,pcts+nbkts) == n)
+      continue;
+
+    for(int b = 0, off = 0; b < nbkts; ++b)
+    {
+      int ct = pcts[b]; pcts[b] = off; off += ct;
+    }
+
+    for(int i = 0 ; i < n; ++i)
+    {
+      int j = pcts[(keys[i] >> (p*nbits))&(nbkts-1)]++;
+      tkeys[j] = keys[i];
+      tvals[j] = vals[i];
+    }
+
+    keys.swap(tkeys);
+    vals.swap(tvals);
+  }
+}
+
+inline uint64_t mk_edge_key(uint u,uint v)
+{
+  if( u > v) std::swap(u,v);
+  return (uint64_t(u) << 32) | uint64_t(v);
+}
+
+void tri_cc_t::init(const tri_idx_list_t &tlist,const uint & N,bool check_manifold)
+{
+  ENSURE(tlist.size() >0 ," No tris!!!");
+  ENSURE(N >0 ," No Verts !!!");
+
+  compile_topology(TOPO_HALF_EDGE);
+
+  check_tlist(tlist,N);
+
+  int T = tlist.size();
+
+  m_verts.resize(N,INVALID_VALUE);
+  m_tris.resize(T*3);
+
+  vector<uint64_t> hkeys(T*3);
+  vector<uint>     hvals(T*3);
+
+  for ( int ti = 0 ; ti < T; ++ti )
+  {
+    const tri_idx_t &t = tlist[ti];
+
+    for( int u = 0,v = 1 ; u < 3 ; ++u, v = (v + 1)%3 )
+    {
+      int tvi = 3*ti + u;
+
+      m_tris[tvi].v     = t[u];
+      m_tris[tvi].fnext = INVALID_VALUE;
+      m_verts[t[u]]     = tvi;
+
+      hkeys[tvi] = mk_edge_key(t[u],t[v]);
+      hvals[tvi] = tvi;
+    }
+  }
+
+  // Sorting is stable, so each run of equal keys is the set of
+  // half edges of one edge in increasing order of tvi.
+  radix_sort(hkeys,hvals);
+
+  for ( int i = 0,j = 0 ; i < T*3; i = j)
+  {
+    for(j = i+1; j < T*3 && hkeys[j] == hkeys[i]; ++j);
+
+    uint tvi = hvals[i];
+
+    ENSUREV2(j - i <= 2,"non manifold edge found",
+             m_tris[tvi].v,m_tris[enext(tvi)].v);
+
+    if( j - i == 2)
+    {
+      uint tvj = hvals[i+1];
+
+      ENSUREV2(m_tris[tvi].v != m_tris[tvj].v,
+               "2 edges with same induced orientation found",
+               m_tris[tvi].v,m_tris[enext(tvi)].v);
+
+      m_tris[tvi].fnext = tvj;
+      m_tris[tvj].fnext = tvi;
+    }
+  }
+
+  // number the edges in the order of the first half edge seen.
+  for ( int tvi = 0 ; tvi < T*3; ++tvi )
+  {
+    uint tvj = m_tris[tvi].fnext;
+
+    if(tvj == INVALID_VALUE || tvi < tvj)
+    {
+      m_tris[tvi].e = m_edges.size();
+      m_edges.push_back(tvi);
+    }
+    else
+    {
+      m_tris[tvi].e = m_tris[tvj].e;
+    }
+  }
+
+  // boundary verts start their walk at the boundary half edge.
+  for ( int tvi = 0 ; tvi < T*3; ++tvi )
+    if(m_tris[tvi].fnext == INVALID_VALUE)
+      m_verts[m_tris[tvi].v] = tvi;
+
+  check_verts(*this);
+
+  if(check_manifold)
+    check_tris(*this);
+}
+
+void tri_cc_t::init_edge_map(const tri_idx_list_t &tlist,const uint & N)
 {
   ENSURE(tlist.size() >0 ," No tris!!!");
   ENSURE(N >0 ," No Verts !!!");
 
+  compile_topology(TOPO_HALF_EDGE);
+
   typedef map<edge_t,int,edge_cmp> edge_map_t;
 
   check_tlist(tlist,N);
@@ -156,11 +294,112 @@ void tri_cc_t::logTriSet ( const uint &trisetstart , std::ostream &os) const
 
 void tri_cc_t::clear()
 {
+  compile_topology(TOPO_HALF_EDGE);
+
   m_tris.clear();
   m_edges.clear();
   m_verts.clear();
 }
 
+template<typename T>
+inline void free_vec(std::vector<T> &v) {std::vector<T>().swap(v);}
+
+void tri_cc_t::compile_topology(eTopology topo)
+{
+  free_vec(m_edge_verts);
+  free_vec(m_edge_tris);
+  free_vec(m_tri_edges);
+  free_vec(m_vert_edge_offs);
+  free_vec(m_vert_edges);
+  free_vec(m_vert_tri_offs);
+  free_vec(m_vert_tris);
+
+  // the tables are filled in by the walks
+  m_topo = TOPO_HALF_EDGE;
+
+  if(topo == TOPO_HALF_EDGE)
+    return;
+
+  const int V = vert_ct(),E = edge_ct(),T = tri_ct();
+
+  m_edge_verts.resize(2*E);
+  m_edge_tris.resize(2*E,-1);
+  m_tri_edges.resize(3*T);
+
+  for(int e = 0 ; e < E; ++e)
+  {
+    get_cell_points(V+e,&m_edge_verts[2*e]);
+    get_cell_co_facets(V+e,&m_edge_tris[2*e]);
+  }
+
+  for(int t = 0 ; t < T; ++t)
+    get_cell_facets(V+E+t,&m_tri_edges[3*t]);
+
+  if(topo == TOPO_FULL)
+  {
+    // the walks see at most deg cells, and fewer around a vertex whose
+    // star is not one fan
+    cellid_list_t deg(V,0);
+
+    for(int i = 0 ; i < 2*E; ++i)
+      deg[m_edge_verts[i]]++;
+
+    cellid_list_t buf(*std::max_element(deg.begin(),deg.end()) + 1);
+
+    m_vert_edge_offs.resize(V+1,0);
+    m_vert_tri_offs.resize(V+1,0);
+
+    for(int v = 0 ; v < V; ++v)
+    {
+      int n = get_cell_co_facets(v,buf.data());
+      m_vert_edges.insert(m_vert_edges.end(),buf.begin(),buf.begin()+n);
+      m_vert_edge_offs[v+1] = m_vert_edges.size();
+
+      n = get_cell_tris(v,buf.data());
+      m_vert_tris.insert(m_vert_tris.end(),buf.begin(),buf.begin()+n);
+      m_vert_tri_offs[v+1] = m_vert_tris.size();
+    }
+  }
+
+  m_topo = topo;
+}
+
+tri_cc_t::eTopology tri_cc_t::topology_from_string(const std::string &s)
+{
+  if(s == "half-edge") return TOPO_HALF_EDGE;
+  if(s == "edges")     return TOPO_EDGES;
+  if(s == "full")      return TOPO_FULL;
+
+  ENSUREV(false,"unknown topology.. use half-edge, edges or full",s);
+  return TOPO_HALF_EDGE;
+}
+
+size_t tri_cc_t::topology_bytes() const
+{
+  return sizeof(cellid_t)*
+      (m_edge_verts.capacity() + m_edge_tris.capacity() +
+       m_tri_edges.capacity() + m_vert_edge_offs.capacity() +
+       m_vert_edges.capacity() + m_vert_tri_offs.capacity() +
+       m_vert_tris.capacity());
+}
+
+inline uint copy_slice(const tri_cc_t::cellid_list_t &vals,
+                       const tri_cc_t::cellid_list_t &offs,int i,
+                       tri_cc_t::cellid_t *o)
+{
+  int b = offs[i],e = offs[i+1];
+  std::copy(vals.begin() + b,vals.begin() + e,o);
+  return e - b;
+}
+
+inline uint copy_edge_tris(const tri_cc_t::cellid_list_t &et,int e,
+                           tri_cc_t::cellid_t *o)
+{
+  o[0] = et[2*e];
+  o[1] = et[2*e+1];
+  return (o[1] == -1)?(1):(2);
+}
+
 uint tri_cc_t::get_cell_dim (cellid_t c) const
 {
   if(c < vert_ct())
@@ -192,6 +431,14 @@ uint tri_cc_t::get_cell_points (cellid_t  c,cellid_t   *p ) const
 
   if(c < edge_ct())
   {
+    if(m_topo != TOPO_HALF_EDGE)
+    {
+      p[0] = m_edge_verts[2*c];
+      p[1] = m_edge_verts[2*c+1];
+
+      return 2;
+    }
+
     uint t = m_edges[c];
 
     p[0] = vertIndex(t); t = enext(t);
@@ -220,6 +467,9 @@ uint tri_cc_t::get_cell_tris(cellid_t  c,cellid_t   *p ) const
 {
   int tbias = vert_ct() + edge_ct();
 
+  if(c < vert_ct() && m_topo == TOPO_FULL)
+    return copy_slice(m_vert_tris,m_vert_tri_offs,c,p);
+
   if(c < vert_ct())
   {
     uint tstart = m_verts[c],t = tstart,ct = 0;
@@ -240,6 +490,9 @@ uint tri_cc_t::get_cell_tris(cellid_t  c,cellid_t   *p ) const
 
   c -= vert_ct();
 
+  if(c < edge_ct() && m_topo != TOPO_HALF_EDGE)
+    return copy_edge_tris(m_edge_tris,c,p);
+
   if(c < edge_ct())
   {
     uint t = m_edges[c];
@@ -277,6 +530,27 @@ uint tri_cc_t::get_cell_facets (cellid_t  c,cellid_t  * f) const
 
   c -= vert_ct();
 
+  if(m_topo != TOPO_HALF_EDGE)
+  {
+    if(c < edge_ct())
+    {
+      f[0] = m_edge_verts[2*c];
+      f[1] = m_edge_verts[2*c+1];
+
+      return 2;
+    }
+
+    c -= edge_ct();
+
+    ASSERT(c < tri_ct());
+
+    f[0] = m_tri_edges[3*c];
+    f[1] = m_tri_edges[3*c+1];
+    f[2] = m_tri_edges[3*c+2];
+
+    return 3;
+  }
+
   if(c < edge_ct())
   {
     uint t = m_edges[c];
@@ -305,6 +579,9 @@ uint tri_cc_t::get_cell_facets (cellid_t  c,cellid_t  * f) const
 
 uint tri_cc_t::get_cell_co_facets (cellid_t c ,cellid_t  * cf) const
 {
+  if(c < vert_ct() && m_topo == TOPO_FULL)
+    return copy_slice(m_vert_edges,m_vert_edge_offs,c,cf);
+
   if(c < vert_ct())
   {
     uint tstart = m_verts[c],t = tstart,cf_ct = 0;
@@ -328,6 +605,9 @@ uint tri_cc_t::get_cell_co_facets (cellid_t c ,cellid_t  * cf) const
 
   c -= vert_ct();
 
+  if(c < edge_ct() && m_topo != TOPO_HALF_EDGE)
+    return copy_edge_tris(m_edge_tris,c,cf);
+
   if(c < edge_ct())
   {
     uint cf_ct = 0,tri_id_bias = edge_ct()+vert_ct(),t = m_edges[c] ;
@@ -355,6 +635,26 @@ uint tri_cc_t::get_cell_co_facets (cellid_t c ,cellid_t  * cf) const
 
 uint tri_cc_t::get_vert_star(cellid_t  c,cellid_t  * cf) const
 {
+  if(c < vert_ct() && m_topo == TOPO_FULL)
+  {
+    // edges and tris alternate. The walk around an interior vertex ends
+    // where it started, so it lists the first edge once more.
+    int eb = m_vert_edge_offs[c], ne = m_vert_edge_offs[c+1] - eb;
+    int tb = m_vert_tri_offs[c],  nt = m_vert_tri_offs[c+1]  - tb;
+
+    uint cf_ct = 0;
+
+    cf[cf_ct++] = m_vert_edges[eb];
+
+    for(int i = 0 ; i < nt; ++i)
+    {
+      cf[cf_ct++] = m_vert_tris[tb + i];
+      cf[cf_ct++] = m_vert_edges[eb + (i+1)%ne];
+    }
+
+    return cf_ct;
+  }
+
   if(c < vert_ct())
   {
     uint tstart = m_verts[c],t = tstart,cf_ct = 0, toff = edge_ct() + vert_ct();
@@ -383,6 +683,22 @@ uint tri_cc_t::get_vert_star(cellid_t  c,cellid_t  * cf) const
 
 uint tri_cc_t::get_vert_link_verts(cellid_t  c,cellid_t  * lv) const
 {
+  if(c < vert_ct() && m_topo == TOPO_FULL)
+  {
+    // the i'th walk step goes along the i'th edge
+    int eb = m_vert_edge_offs[c];
+    int nt = m_vert_tri_offs[c+1] - m_vert_tri_offs[c];
+
+    for(int i = 0 ; i < nt; ++i)
+    {
+      const cellid_t *ev = &m_edge_verts[2*(m_vert_edges[eb + i] - vert_ct())];
+
+      lv[i] = (ev[0] == c)?(ev[1]):(ev[0]);
+    }
+
+    return nt;
+  }
+
   if(c < vert_ct())
   {
     uint tstart = m_verts[c],t = tstart,lv_ct = 0;
@@ -411,6 +727,19 @@ bool tri_cc_t::is_adjacent(cellid_t  c,cellid_t p) const
   if(c > p)
     std::swap(c,p);
 
+  if(m_topo == TOPO_FULL && c < vert_ct())
+  {
+    return std::find(m_vert_edges.begin() + m_vert_edge_offs[c],
+                     m_vert_edges.begin() + m_vert_edge_offs[c+1],p)
+        != m_vert_edges.begin() + m_vert_edge_offs[c+1];
+  }
+
+  if(m_topo != TOPO_HALF_EDGE && is_in_range(c,vert_ct(),vert_ct()+edge_ct()))
+  {
+    c -= vert_ct();
+    return m_edge_tris[2*c] == p || m_edge_tris[2*c+1] == p;
+  }
+
   if(c < vert_ct())
   {
     uint tstart = m_verts[c], t = tstart;
@@ -497,8 +826,18 @@ tri_cc_t::cellid_t tri_cc_t::get_opp_cell(cellid_t c, cellid_t cf) const
   {
     cf -= vert_ct();
 
-    cellid_t u = m_tris[m_edges[cf]].v;
-    cellid_t v = m_tris[enext(m_edges[cf])].v;
+    cellid_t u,v;
+
+    if(m_topo != TOPO_HALF_EDGE)
+    {
+      u = m_edge_verts[2*cf];
+      v = m_edge_verts[2*cf+1];
+    }
+    else
+    {
+      u = m_tris[m_edges[cf]].v;
+      v = m_tris[enext(m_edges[cf])].v;
+    }
 
     ASSERT(u == c || v == c);
 
@@ -52,12 +52,43 @@ public:
   cellid_list_t m_verts;   // index list to tris that contain {v1} = {a}
   cellid_list_t m_edges;   // index list to tris that contain {v1,v2} = {a,b}
 
+  /// \brief How much of the topology is precomputed into flat tables
+  enum eTopology
+  {
+    TOPO_HALF_EDGE, // walk m_tris on every query.. no extra memory
+    TOPO_EDGES,     // + edge->vert, edge->tri and tri->edge tables.. 4E+3T ints
+    TOPO_FULL,      // + vert->edge and vert->tri csr tables.. ~2E+3T+2V more
+  };
+
+  eTopology     m_topo;
+  cellid_list_t m_edge_verts;     // 2 per edge
+  cellid_list_t m_edge_tris;      // 2 per edge (tri cellids).. -1 if none
+  cellid_list_t m_tri_edges;      // 3 per tri (edge cellids)
+  cellid_list_t m_vert_edge_offs; // csr offsets into m_vert_edges
+  cellid_list_t m_vert_edges;     // edge cellids around each vert
+  cellid_list_t m_vert_tri_offs;  // csr offsets into m_vert_tris
+  cellid_list_t m_vert_tris;      // tri cellids around each vert
+
   tri_cc_t();
   ~tri_cc_t();
 
-  void init(const tri_idx_list_t &,const uint & num_verts);
+  /// \note If check_manifold is false, vertices whose star is not a single
+  ///       fan are let through. Walks around such a vertex see only one fan.
+  void init(const tri_idx_list_t &,const uint & num_verts,bool check_manifold=true);
+
+  // reference std::map based init.. much slower.. kept for benchmarking
+  void init_edge_map(const tri_idx_list_t &,const uint & num_verts);
   void clear();
 
+  /// \brief Precompute neighbourhood tables so that the queries below read
+  ///        contiguous array slices instead of walking m_tris
+  /// \note  The tables list cells in the order that the walks do, so every
+  ///        query returns the same list in every mode.
+  void compile_topology(eTopology t);
+  inline eTopology get_topology() const {return m_topo;}
+  static eTopology topology_from_string(const std::string &s);
+  size_t topology_bytes() const;
+
   void logTri(const uint &qpos , std::ostream &os = std::cout) const ;
   void logTriSet(const uint &trisetstart, std::ostream &os = std::cout) const;
 
@@ -77,6 +108,8 @@ public:
   uint get_cell_tris(cellid_t  ,cellid_t   * ) const;
   uint get_cell_facets(cellid_t  ,cellid_t  * ) const;
   uint get_cell_co_facets(cellid_t  ,cellid_t  * ) const;
+  inline cellid_t get_cell_facet(cellid_t c,int k) const;    // k'th of get_cell_facets
+  inline cellid_t get_cell_co_facet(cellid_t c,int k) const; // k'th of get_cell_co_facets.. edges only
   uint get_vert_star(cellid_t  ,cellid_t  * ) const;
   uint get_vert_link_verts(cellid_t  ,cellid_t  * ) const;
   cellid_t get_opp_cell(cellid_t c, cellid_t cf) const;
@@ -239,6 +272,49 @@ inline tri_cc_t::iterator tri_cc_t::end(int i) const
 inline uint enext ( uint t ){return ( 3* ( t/3 ) + ( t+1 ) %3 );}
 inline uint eprev ( uint t ){ return ( 3* ( t/3 ) + ( t+2 ) %3 );}
 
+inline tri_cc_t::cellid_t tri_cc_t::get_cell_facet(cellid_t c,int k) const
+{
+  ASSERT(is_in_range(c,vert_ct(),get_num_cells()));
+
+  c -= vert_ct();
+
+  if(c < edge_ct())
+  {
+    ASSERT(k < 2);
+
+    if(m_topo != TOPO_HALF_EDGE)
+      return m_edge_verts[2*c+k];
+
+    return m_tris[(k == 0)?(m_edges[c]):(enext(m_edges[c]))].v;
+  }
+
+  c -= edge_ct();
+
+  ASSERT(k < 3);
+
+  if(m_topo != TOPO_HALF_EDGE)
+    return m_tri_edges[3*c+k];
+
+  return vert_ct() + m_tris[3*c+k].e;
+}
+
+inline tri_cc_t::cellid_t tri_cc_t::get_cell_co_facet(cellid_t c,int k) const
+{
+  ASSERT(is_in_range(c,vert_ct(),vert_ct()+edge_ct()));
+
+  c -= vert_ct();
+
+  if(m_topo != TOPO_HALF_EDGE)
+    return m_edge_tris[2*c+k];
+
+  uint t = m_edges[c];
+
+  if(k == 1)
+    t = fnext(t);
+
+  return vert_ct() + edge_ct() + t/3;
+}
+
 template<typename Oi>
 inline Oi tri_cc_t::cellid_to_output(cellid_t c,Oi o)
 {
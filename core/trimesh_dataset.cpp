@@ -1,7 +1,10 @@
+#include <numeric>
+
 #include <boost/typeof/typeof.hpp>
 #include <boost/foreach.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/range/algorithm.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <trimesh_dataset.h>
 #include <trimesh_mscomplex.h>
@@ -15,46 +18,151 @@ namespace trimesh
 {
   dataset_t::dataset_t
   (const fn_list_t &vert_fns, const tri_idx_list_t &trilist):
-    m_vert_fns(vert_fns),m_tcc(new tri_cc_t)
+    m_vert_fns(vert_fns),m_gradient(GRAD_PASSES),m_tcc(new tri_cc_t)
   {
     m_tcc->init(trilist,vert_fns.size());
 
-    int N = m_tcc->get_num_cells();
-
-    m_cell_own.resize(N,invalid_cellid);
-    m_cell_mxfct.resize(N,invalid_cellid);
-    m_cell_pairs.resize(N,invalid_cellid);
+    init_cell_state();
   }
 
   dataset_t::dataset_t
   (const fn_list_t &vert_fns,tri_cc_ptr_t tcc):
-    m_vert_fns(vert_fns),m_tcc(tcc)
+    m_vert_fns(vert_fns),m_gradient(GRAD_PASSES),m_tcc(tcc)
   {
-    int N = m_tcc->get_num_cells();
-
-    m_cell_own.resize(N,invalid_cellid);
-    m_cell_mxfct.resize(N,invalid_cellid);
-    m_cell_pairs.resize(N,invalid_cellid);
+    init_cell_state();
   }
 
 
   dataset_t::~dataset_t ()
   {
     m_cell_own.clear();
-    m_cell_mxfct.clear();
+    m_cell_flags.clear();
     m_cell_pairs.clear();
 //    m_tcc->clear();
   }
 
+  void dataset_t::init_cell_state()
+  {
+    int N = m_tcc->get_num_cells();
+
+    m_cell_own.resize(m_tcc->vert_ct() + m_tcc->tri_ct(),invalid_cellid);
+    m_cell_flags.resize(N,0);
+    m_cell_pairs.resize(N,CS_PAIR_NONE);
+
+#pragma omp parallel for schedule(dynamic,4096)
+    for(int c = 0 ; c < N; ++c)
+      if(m_tcc->is_cell_boundry(c))
+        m_cell_flags[c] = CS_BOUNDRY;
+  }
+
+  size_t dataset_t::state_bytes() const
+  {
+    return m_cell_flags.size() + m_cell_pairs.size() +
+        m_cell_own.size()*sizeof(cellid_t) +
+        m_cell_rank.size()*sizeof(uint32_t);
+  }
+
+  /// \brief Orders indices by their keys
+  struct key_lt_t
+  {
+    const rank_list_t &key;
+    key_lt_t(const rank_list_t &k):key(k){}
+
+    inline bool operator()(int a,int b) const
+    {return key[a] < key[b];}
+  };
+
+  /// \brief Rank the dim cells in the order of compare_cells_fn<dim>, given
+  ///        the ranks of the verts and the dim-1 cells
+  /// \note  The first key is the rank of the max facet. So the cells are
+  ///        counting sorted on it, and only the few cells that share a max
+  ///        facet are sorted on the vert opposite it.
+  template <int dim>
+  inline void rank_dim_cells(dataset_t &ds)
+  {
+    const tri_cc_t &tcc = *ds.m_tcc;
+    rank_list_t    &rank = ds.m_cell_rank;
+
+    int b = *tcc.begin(dim), n = tcc.get_num_cells_dim(dim);
+    int nf = tcc.get_num_cells_dim(dim-1);
+
+    rank_list_t fkey(n),okey(n);
+
+#pragma omp parallel for schedule(dynamic,4096)
+    for(int i = 0 ; i < n; ++i)
+    {
+      cellid_t f[4],mf;
+      int      fct = tcc.get_cell_facets(b+i,f);
+
+      mf = f[0];
+
+      for(int j = 1 ; j < fct; ++j)
+        if(rank[mf] < rank[f[j]])
+          mf = f[j];
+
+      cellid_t o = tcc.get_opp_cell(mf,b+i);
+
+      fkey[i] = rank[mf];
+      okey[i] = ((ds.is_boundry(o))?(0):(1u << 31)) | rank[o];
+    }
+
+    int_list_t offs(nf+2,0),order(n);
+
+    for(int i = 0 ; i < n; ++i)
+      offs[fkey[i]+2]++;
+
+    partial_sum(offs.begin(),offs.end(),offs.begin());
+
+    for(int i = 0 ; i < n; ++i)
+      order[offs[fkey[i]+1]++] = i;
+
+#pragma omp parallel for schedule(dynamic,4096)
+    for(int r = 0 ; r < nf; ++r)
+      if(offs[r+1] - offs[r] > 1)
+        sort(order.begin()+offs[r],order.begin()+offs[r+1],key_lt_t(okey));
+
+#pragma omp parallel for schedule(static)
+    for(int k = 0 ; k < n; ++k)
+      rank[b+order[k]] = k;
+  }
+
+  void dataset_t::rank_cells()
+  {
+    int V = m_tcc->vert_ct();
+
+    ENSUREV(m_vert_fns.size() == V,"need one fn per vert",m_vert_fns.size());
+
+    m_cell_rank.resize(m_tcc->get_num_cells());
+
+    std::vector<size_t> order;
+    utl::argsort(m_vert_fns.begin(),m_vert_fns.end(),order);
+
+#pragma omp parallel for schedule(static)
+    for(int i = 0 ; i < V; ++i)
+      m_cell_rank[order[i]] = i;
+
+    rank_dim_cells<1>(*this);
+    rank_dim_cells<2>(*this);
+  }
+
+  // All the passes below are split over cells with openmp. Each cell writes
+  // only its own max_fct/pair entries and reads state that was finalized
+  // by an earlier pass, so the result does not depend on the thread count.
+
   template <int dim,typename Titer>
   inline void assign_max_facets(dataset_t &ds,Titer b,Titer e)
   {
-    cellid_t f[10];
-
     BOOST_AUTO(cmp,bind(&dataset_t::compare_cells<dim-1>,&ds,_1,_2));
 
-    for(;b!=e;++b)
-      ds.max_fct(*b) = *max_element(f,f+ds.get_cets<DES>(*b,f),cmp);
+    int n = e - b;
+
+#pragma omp parallel for schedule(dynamic,1024)
+    for(int i = 0 ; i < n; ++i)
+    {
+      cellid_t f[10];
+
+      ds.max_fct(b[i],*max_element(f,f+ds.get_cets<DES>(b[i],f),cmp));
+    }
   }
 
   inline cellid_t * filter_elst(cellid_t *b,cellid_t *e, cellid_t *r, cellid_t c,const dataset_t &ds)
@@ -63,26 +171,30 @@ namespace trimesh
   template <int dim,typename Titer>
   inline void assign_pairs(dataset_t &ds,Titer b,Titer e)
   {
-    cellid_t cf[10],*cfe;
-
     BOOST_AUTO(cmp,bind(&dataset_t::compare_cells<dim+1>,&ds,_1,_2));
 
-    for(;b!=e;++b)
+    int n = e - b;
+
+    // a cofacet has a unique max facet. So no two cells compete for it.
+#pragma omp parallel for schedule(dynamic,1024)
+    for(int i = 0 ; i < n; ++i)
     {
-      cfe = cf + ds.get_cets<ASC>(*b,cf);
-      cfe = filter_elst(cf,cfe,cf,*b,ds);
+      cellid_t cf[10],*cfe, c = b[i];
+
+      cfe = cf + ds.get_cets<ASC>(c,cf);
+      cfe = filter_elst(cf,cfe,cf,c,ds);
 
       cellid_t *mcf = min_element(cf,cfe,cmp);
 
-      if( mcf != cfe && ds.is_boundry(*mcf) == ds.is_boundry(*b))
-        ds.pair(*b,*mcf);
+      if( mcf != cfe && ds.is_boundry(*mcf) == ds.is_boundry(c))
+        ds.pair(c,*mcf);
     }
   }
 
   inline cellid_t * filter_elst2(cellid_t *b,cellid_t *e, cellid_t *r, cellid_t c,const dataset_t &ds)
   {
     for(;b!=e; ++b)
-      if( !ds.is_paired(*b) && ds.max_fct(*b) != c && ds.max_fct(ds.max_fct(*b)) == ds.max_fct(c))
+      if( ds.max_fct(*b) != c && ds.max_fct(ds.max_fct(*b)) == ds.max_fct(c) && !ds.is_paired(*b))
         *r++ = *b;
 
     return r;
@@ -91,25 +203,213 @@ namespace trimesh
   template <int dim,typename Titer>
   inline void assign_pairs2(dataset_t &ds,Titer b,Titer e)
   {
-    cellid_t cf[10],*cfe;
-
     BOOST_AUTO(cmp,bind(&dataset_t::compare_cells<dim+1>,&ds,_1,_2));
 
-    int np = 0;
+    int n = e - b;
 
-    for(;b!=e;++b)
-      if(!ds.is_paired(*b))
+    // only one non max facet of a cofacet shares the max facet's own max
+    // facet. So again no two cells compete for it.
+#pragma omp parallel for schedule(dynamic,1024)
+    for(int i = 0 ; i < n; ++i)
+    {
+      cellid_t cf[10],*cfe, c = b[i];
+
+      if(ds.is_paired(c))
+        continue;
+
+      cfe = cf + ds.get_cets<ASC>(c,cf);
+      cfe = filter_elst2(cf,cfe,cf,c,ds);
+
+      cellid_t *mcf = min_element(cf,cfe,cmp);
+
+      if( mcf != cfe && ds.is_boundry(*mcf) == ds.is_boundry(c))
+        ds.pair(c,*mcf);
+    }
+  }
+
+  /// \brief Tiny min queue of the cells of a lower star. Stars are small,
+  ///        so a scan for the min beats a heap.
+  struct lstar_queue_t
+  {
+    int n, idx[80];
+
+    lstar_queue_t():n(0){}
+
+    inline bool empty() const {return n == 0;}
+    inline void push(int i) {ASSERT(n < 80); idx[n++] = i;}
+
+    inline int pop(const uint64_t *key)
+    {
+      int m = 0;
+
+      for(int j = 1 ; j < n; ++j)
+        if(key[idx[j]] < key[idx[m]])
+          m = j;
+
+      int i = idx[m];
+      idx[m] = idx[--n];
+      return i;
+    }
+  };
+
+  /// \brief The cells of the lower star of a vert: edges then tris. A vert
+  ///        has at most 40 edges and 40 tris, as elsewhere in dataset_t.
+  struct lower_star_t
+  {
+    cellid_t cell[80];
+    uint64_t key[80];    // ranks of the other verts, higher first
+    bool     bnd[80];
+    bool     done[80];   // paired or left critical
+    int      fct[80][2]; // tris : their two lower star edges
+    int      cof[80][2]; // edges: their lower star tris
+    int      ncof[80];
+    int      ne,n;
+
+    /// \brief Number of faces of tri i that are not done.. f is one of them
+    inline int num_unpaired(int i,int &f) const
+    {
+      int ct = 0;
+
+      for(int j = 0 ; j < 2; ++j)
+        if(!done[fct[i][j]] && bnd[fct[i][j]] == bnd[i])
+        {
+          f = fct[i][j];
+          ++ct;
+        }
+
+      return ct;
+    }
+  };
+
+  /// \brief Pair the cells of the lower star of v, the cells whose max vert
+  ///        is v, as ProcessLowerStars (Robins et al. 2011) does
+  /// \note  Boundary cells are only paired among themselves, as in
+  ///        assign_pairs. So the boundary cells are done first and then the
+  ///        others, each as a lower star of its own.
+  inline void assign_lower_star_pairs(dataset_t &ds,cellid_t v)
+  {
+    const tri_cc_t    &tcc  = *ds.m_tcc;
+    const rank_list_t &rank = ds.m_cell_rank;
+
+    lower_star_t ls;
+    cellid_t     st[40];
+    int          &ne = ls.ne,&n = ls.n;
+
+    ne = 0;
+
+    for(int i = 0, k = tcc.get_cell_co_facets(v,st); i < k; ++i)
+    {
+      cellid_t a = tcc.get_opp_cell(v,st[i]);
+
+      if(rank[a] < rank[v])
       {
-        cfe = cf + ds.get_cets<ASC>(*b,cf);
-        cfe = filter_elst2(cf,cfe,cf,*b,ds);
+        ls.key[ne]  = uint64_t(rank[a]) << 32;
+        ls.ncof[ne] = 0;
+        ls.cell[ne++] = st[i];
+      }
+    }
+
+    n = ne;
+
+    for(int i = 0, k = tcc.get_cell_tris(v,st); i < k; ++i)
+    {
+      cellid_t f[3];
+      int      nf = 0;
+
+      tcc.get_cell_facets(st[i],f);
 
-        cellid_t *mcf = min_element(cf,cfe,cmp);
+      for(int j = 0 ; j < 3; ++j)
+        for(int l = 0 ; l < ne; ++l)
+          if(ls.cell[l] == f[j])
+            ls.fct[n][nf++] = l;
+
+      if(nf != 2)
+        continue;
+
+      int      e0 = ls.fct[n][0], e1 = ls.fct[n][1];
+      uint32_t a  = ls.key[e0] >> 32, b = ls.key[e1] >> 32;
+
+      ls.key[n] = (uint64_t(std::max(a,b)) << 32) | (std::min(a,b) + 1);
+
+      ls.cof[e0][ls.ncof[e0]++] = n;
+      ls.cof[e1][ls.ncof[e1]++] = n;
+
+      ls.cell[n++] = st[i];
+    }
+
+    ASSERT(n <= 80);
+
+    for(int i = 0 ; i < n; ++i)
+    {
+      ls.bnd[i]  = ds.is_boundry(ls.cell[i]);
+      ls.done[i] = false;
+    }
 
-        if( mcf != cfe && ds.is_boundry(*mcf) == ds.is_boundry(*b))
+    for(int bnd = 1 ; bnd >= 0; --bnd)
+    {
+      lstar_queue_t pq0,pq1;
+      int           d = -1,f;
+
+      if(ds.is_boundry(v) == bool(bnd))
+      {
+        for(int i = 0 ; i < ne; ++i)
+          if(ls.bnd[i] == bool(bnd) && (d == -1 || ls.key[i] < ls.key[d]))
+            d = i;
+
+        if(d != -1)
         {
-          ds.pair(*b,*mcf); np++;
+          ds.pair(v,ls.cell[d]);
+          ls.done[d] = true;
         }
       }
+
+      for(int i = 0 ; i < ne; ++i)
+        if(i != d && ls.bnd[i] == bool(bnd))
+          pq0.push(i);
+
+      for(int i = ne ; i < n; ++i)
+        if(ls.bnd[i] == bool(bnd) && ls.num_unpaired(i,f) == 1)
+          pq1.push(i);
+
+      while(!pq0.empty() || !pq1.empty())
+      {
+        while(!pq1.empty())
+        {
+          int a = pq1.pop(ls.key);
+
+          if(ls.done[a])
+            continue;
+
+          if(ls.num_unpaired(a,f) == 0)
+          {
+            pq0.push(a);
+            continue;
+          }
+
+          ds.pair(ls.cell[f],ls.cell[a]);
+          ls.done[f] = ls.done[a] = true;
+
+          for(int j = 0,g ; j < ls.ncof[f]; ++j)
+            if(!ls.done[ls.cof[f][j]] && ls.num_unpaired(ls.cof[f][j],g) == 1)
+              pq1.push(ls.cof[f][j]);
+        }
+
+        if(pq0.empty())
+          break;
+
+        // left critical
+        int c = pq0.pop(ls.key);
+
+        if(ls.done[c])
+          continue;
+
+        ls.done[c] = true;
+
+        for(int j = 0 ; c < ne && j < ls.ncof[c]; ++j)
+          if(!ls.done[ls.cof[c][j]] && ls.num_unpaired(ls.cof[c][j],f) == 1)
+            pq1.push(ls.cof[c][j]);
+      }
+    }
   }
 
   template<typename Toi,typename Tii>
@@ -122,6 +422,41 @@ namespace trimesh
     return r;
   }
 
+  /// \brief All the critical cells in order, compacted in parallel
+  /// \note  Each chunk of cells counts its critical cells. A prefix sum of
+  ///        the counts then gives each chunk its place in ccells.
+  inline void collect_cps(const dataset_t &ds,cellid_list_t &ccells)
+  {
+    int N = ds.m_tcc->get_num_cells();
+    int k = std::max(1,std::min(utl::get_num_threads(),N/4096));
+
+    int_list_t cb(k+1),offs(k+1,0);
+
+    for(int i = 0 ; i <= k; ++i)
+      cb[i] = (long(N)*i)/k;
+
+#pragma omp parallel for schedule(static,1)
+    for(int i = 0 ; i < k; ++i)
+    {
+      int ct = 0;
+
+      for(cellid_t c = cb[i] ; c < cb[i+1]; ++c)
+        if(!ds.is_paired(c))
+          ++ct;
+
+      offs[i+1] = ct;
+    }
+
+    partial_sum(offs.begin(),offs.end(),offs.begin());
+
+    ccells.resize(offs[k]);
+
+#pragma omp parallel for schedule(static,1)
+    for(int i = 0 ; i < k; ++i)
+      collect_cps(ds,ds.m_tcc->begin()+cb[i],ds.m_tcc->begin()+cb[i+1],
+                  ccells.begin()+offs[i]);
+  }
+
   template <eGDIR dir>
   inline void bfs_owner_extrema(dataset_t &ds,cellid_t s)
   {
@@ -151,66 +486,506 @@ namespace trimesh
     }
   }
 
+  /// \brief Find the owners of all cells from the extrema among ccells
+  /// \note  Each extremum owns a disjoint set of cells. So the traversals
+  ///        can run concurrently and m_cell_own does not depend on their
+  ///        order.
+  inline void assign_owners(dataset_t &ds,const cellid_list_t &ccells)
+  {
+    int nccells = ccells.size();
+
+#pragma omp parallel for schedule(dynamic,16)
+    for(int i = 0 ; i < nccells; ++i)
+    {
+      if(ds.cell_dim(ccells[i]) == 2) bfs_owner_extrema<DES>(ds,ccells[i]);
+      if(ds.cell_dim(ccells[i]) == 0) bfs_owner_extrema<ASC>(ds,ccells[i]);
+    }
+  }
+
   inline void make_connections(mscomplex_t &msc,const cellid_list_t &ccells,const dataset_t &ds)
   {
-    msc.resize(ccells.size());
+    int n = ccells.size();
 
-    map<cellid_t,int> id_cp_map;
+    msc.resize(n);
 
-    for( int i = 0 ; i < ccells.size() ; ++i)
+    for( int i = 0 ; i < n ; ++i)
     {
       cellid_t c = ccells[i];
       msc.set_critpt(i,c,ds.cell_dim(c),ds.fn<dataset_t::CFI_MAX>(c),ds.max_vert<-1>(c),ds.is_boundry(c));
-      id_cp_map[c] = i;
     }
 
-    cellid_t f[20]; int f_ct;
-
-    for(cellid_list_t::const_iterator b = ccells.begin(),e =ccells.end();b!=e; ++b)
-      if(ds.cell_dim(*b) == 1)
-      {
-        ASSERT(id_cp_map.count(*b) ==1);
-        ds.get_cets<DES>(*b,f);
+    // cp index of each cell.. only read at the critical ones
+    int_list_t cp_idx(ds.m_tcc->get_num_cells());
 
-        ASSERT(id_cp_map.count(ds.owner(f[0])) == 1);
-        msc.connect_cps(id_cp_map[*b],id_cp_map[ds.owner(f[0])]);
+#pragma omp parallel for
+    for(int i = 0 ; i < n; ++i)
+      cp_idx[ccells[i]] = i;
 
-        ASSERT(id_cp_map.count(ds.owner(f[1])) == 1);
-        msc.connect_cps(id_cp_map[*b],id_cp_map[ds.owner(f[1])]);
+    // The extrema at the ends of each saddle's arcs are found in parallel.
+    // They are then connected in cp order, as connect_cps writes to both
+    // ends, so the complex is the same as if it were made serially.
+    int_list_t ends(4*n,-1);
 
-        f_ct = ds.get_cets<ASC>(*b,f);
+#pragma omp parallel for schedule(dynamic,1024)
+    for(int i = 0 ; i < n; ++i)
+      if(ds.cell_dim(ccells[i]) == 1)
+      {
+        cellid_t f[20]; int f_ct;
 
-        ASSERT(id_cp_map.count(ds.owner(f[0])) == 1);
-        msc.connect_cps(id_cp_map[*b],id_cp_map[ds.owner(f[0])]);
+        f_ct  = ds.get_cets<DES>(ccells[i],f);
+        f_ct += ds.get_cets<ASC>(ccells[i],f+f_ct);
 
-        if(f_ct == 1) continue;
+        for(int j = 0 ; j < f_ct; ++j)
+        {
+          cellid_t o = ds.owner(f[j]);
 
-        ASSERT(id_cp_map.count(ds.owner(f[1])) == 1);
-        msc.connect_cps(id_cp_map[*b],id_cp_map[ds.owner(f[1])]);
+          ASSERT(ds.is_critical(o) && ccells[cp_idx[o]] == o);
+          ends[4*i+j] = cp_idx[o];
+        }
       }
+
+    for(int i = 0 ; i < n; ++i)
+      for(int j = 0 ; j < 4 && ends[4*i+j] != -1; ++j)
+        msc.connect_cps(i,ends[4*i+j]);
   }
 
-  void dataset_t::work(mscomplex_ptr_t msc)
+  void dataset_t::work_gradient()
   {
+    // every compare below is of two ranks. update() compares the few cells
+    // of its region from the fns instead of ranking all cells again.
+    rank_cells();
+
     assign_max_facets<1>(*this,m_tcc->begin(1),m_tcc->end(1));
     assign_max_facets<2>(*this,m_tcc->begin(2),m_tcc->end(2));
 
-    assign_pairs<0>(*this,m_tcc->begin(0),m_tcc->end(0));
-    assign_pairs<1>(*this,m_tcc->begin(1),m_tcc->end(1));
+    if(m_gradient == GRAD_LOWER_STAR)
+    {
+      // each cell is in the lower star of one vert. So no two verts write
+      // to the same cell.
+      int V = m_tcc->vert_ct();
+
+#pragma omp parallel for schedule(dynamic,1024)
+      for(int v = 0 ; v < V; ++v)
+        assign_lower_star_pairs(*this,v);
+    }
+    else
+    {
+      assign_pairs<0>(*this,m_tcc->begin(0),m_tcc->end(0));
+      assign_pairs<1>(*this,m_tcc->begin(1),m_tcc->end(1));
+
+      assign_pairs2<1>(*this,m_tcc->begin(1),m_tcc->end(1));
+    }
+
+    rank_list_t().swap(m_cell_rank);
+  }
+
+  dataset_t::eGradient dataset_t::gradient_from_string(const std::string &s)
+  {
+    if(s == "passes")     return GRAD_PASSES;
+    if(s == "lower-star") return GRAD_LOWER_STAR;
+
+    ENSUREV(false,"unknown gradient.. use passes or lower-star",s);
+    return GRAD_PASSES;
+  }
+
+  void dataset_t::work(mscomplex_ptr_t msc)
+  {
+    work_gradient();
+
+    cellid_list_t &ccells = m_ccells;
+
+    collect_cps(*this,ccells);
+    assign_owners(*this,ccells);
+    make_connections(*msc,ccells,*this);
+
+    m_ccell_cps.resize(ccells.size());
+    m_free_cps.clear();
+
+    for(int i = 0 ; i < ccells.size(); ++i)
+      m_ccell_cps[i] = i;
+  }
+
+  void dataset_t::encode_gradient(std::vector<uint8_t> &code) const
+  {
+    int V = m_tcc->vert_ct(), N = m_tcc->get_num_cells();
+    int n = (N - V + 3)/4;
+
+    code.assign(n,0);
+
+#pragma omp parallel for schedule(static,4096)
+    for(int i = 0 ; i < n; ++i)
+      for(int j = 0 ; j < 4 && V + 4*i + j < N; ++j)
+      {
+        uint8_t s = m_cell_pairs[V + 4*i + j];
+
+        if((s & CS_PAIR_MASK) == CS_PAIR_FCT)
+          code[i] |= (1 + (s >> CS_PAIR_SHIFT)) << (2*j);
+      }
+  }
+
+  void dataset_t::decode_gradient(const uint8_t *code,size_t n)
+  {
+    int V = m_tcc->vert_ct(), N = m_tcc->get_num_cells();
 
-    assign_pairs2<1>(*this,m_tcc->begin(1),m_tcc->end(1));
+    ENSUREV(n == (N - V + 3)/4,"gradient code is not of this mesh",n);
 
-    cellid_list_t ccells;
+    fill(m_cell_pairs.begin(),m_cell_pairs.end(),uint8_t(CS_PAIR_NONE));
+    fill(m_cell_own.begin(),m_cell_own.end(),invalid_cellid);
 
-    collect_cps(*this,m_tcc->begin(),m_tcc->end(),back_inserter(ccells));
+    // Edges and then tris, so that each pass writes distinct cells. An
+    // edge has no third facet, so a code of 3 on one is an error.
+    int bad = 0;
 
-    for(cellid_list_t::iterator b = ccells.begin(),e =ccells.end();b!=e; ++b)
+    for(int dim = 1 ; dim <= 2; ++dim)
     {
-      if(cell_dim(*b) == 2) bfs_owner_extrema<DES>(*this,*b);
-      if(cell_dim(*b) == 0) bfs_owner_extrema<ASC>(*this,*b);
+      int b = *m_tcc->begin(dim), e = *m_tcc->end(dim);
+
+#pragma omp parallel for schedule(static,4096) reduction(+:bad)
+      for(int c = b ; c < e; ++c)
+      {
+        int k = (code[(c - V)/4] >> (2*((c - V)%4))) & 3;
+
+        if(k == 3 && dim == 1)
+          ++bad;
+        else if(k != 0)
+          pair(m_tcc->get_cell_facet(c,k-1),c);
+      }
     }
 
-    make_connections(*msc,ccells,*this);
+    ENSUREV(bad == 0,"gradient code has edges with no such facet",bad);
+
+    collect_cps(*this,m_ccells);
+    assign_owners(*this,m_ccells);
+
+    // as in the msc that work() made, which the gradient was saved with
+    m_ccell_cps.resize(m_ccells.size());
+    m_free_cps.clear();
+
+    for(int i = 0 ; i < m_ccells.size(); ++i)
+      m_ccell_cps[i] = i;
+  }
+
+  /// \brief Add num_rings rings of link verts to verts.. result is sorted
+  inline void grow_vert_rings(const tri_cc_t &tcc,cellid_list_t &verts,int num_rings)
+  {
+    sort(verts.begin(),verts.end());
+    verts.erase(unique(verts.begin(),verts.end()),verts.end());
+
+    boost::unordered_map<cellid_t,bool> seen;
+    BOOST_FOREACH(cellid_t v,verts) seen[v] = true;
+
+    cellid_t lv[40];
+
+    for(int r = 0, b = 0 ; r < num_rings; ++r)
+    {
+      int e = verts.size();
+
+      for(int i = b ; i < e; ++i)
+        for(int j = 0, n = tcc.get_vert_link_verts(verts[i],lv); j < n; ++j)
+          if(seen.insert(make_pair(lv[j],true)).second)
+            verts.push_back(lv[j]);
+
+      b = e;
+    }
+
+    sort(verts.begin(),verts.end());
+  }
+
+  /// \brief The edges and tris of the stars of verts, each sorted
+  inline void collect_star(const tri_cc_t &tcc,const cellid_list_t &verts,
+                           cellid_list_t &edges,cellid_list_t &tris)
+  {
+    cellid_t cf[40];
+
+    BOOST_FOREACH(cellid_t v,verts)
+    {
+      edges.insert(edges.end(),cf,cf + tcc.get_cell_co_facets(v,cf));
+      tris.insert(tris.end(),cf,cf + tcc.get_cell_tris(v,cf));
+    }
+
+    sort(edges.begin(),edges.end());
+    edges.erase(unique(edges.begin(),edges.end()),edges.end());
+    sort(tris.begin(),tris.end());
+    tris.erase(unique(tris.begin(),tris.end()),tris.end());
+  }
+
+  /// \brief Next cell of the gradient path from a paired vert (ASC) or
+  ///        tri (DES) towards its owner
+  template <eGDIR dir>
+  inline cellid_t next_on_path(const dataset_t &ds,cellid_t c)
+  {
+    cellid_t p = ds.pair(c),cf[2];
+
+    if(dir == ASC)
+      return ds.m_tcc->get_opp_cell(c,p);
+
+    ds.get_cets<ASC>(p,cf);
+    return (cf[0] == c)?(cf[1]):(cf[0]);
+  }
+
+  /// \brief Redo the owners of the cells whose gradient paths pass through
+  ///        any of the seeds. All other owners are still valid.
+  template <eGDIR dir>
+  inline void update_owners(dataset_t &ds,const cellid_list_t &seeds,
+                            cellid_list_t &cells)
+  {
+    const int dim = (dir == DES)?(gc_max_cell_dim):(0);
+
+    // The cells upstream of the seeds. A path outside the seeds is made of
+    // pairs that have not changed, so these are the same before and after.
+    boost::unordered_map<cellid_t,cellid_t> own;
+    cells = seeds;
+
+    BOOST_FOREACH(cellid_t c,seeds) own[c] = invalid_cellid;
+
+    cellid_t f[20],*fe,*fb;
+
+    for(int i = 0 ; i < cells.size(); ++i)
+    {
+      cellid_t c = cells[i];
+
+      fb = f; fe = f + ds.get_cets<dir>(c,f);
+
+      for (; fb != fe; ++fb )
+        if( ds.is_paired(*fb))
+        {
+          cellid_t p = ds.pair(*fb);
+          if(p != c && ds.cell_dim(p) == dim &&
+             own.insert(make_pair(p,invalid_cellid)).second)
+            cells.push_back(p);
+        }
+    }
+
+    // follow each path till it leaves them or ends. Paths share their ends,
+    // so each cell is walked once.
+    cellid_list_t path;
+
+    BOOST_FOREACH(cellid_t c,cells)
+    {
+      cellid_t o = invalid_cellid,x = c;
+
+      path.clear();
+
+      while(true)
+      {
+        BOOST_AUTO(it,own.find(x));
+
+        if(it == own.end())                {o = ds.m_cell_own[ds.own_idx(x)]; break;}
+        if(it->second != invalid_cellid)   {o = it->second;  break;}
+
+        path.push_back(x);
+
+        if(ds.is_critical(x))              {o = x; break;}
+
+        x = next_on_path<dir>(ds,x);
+      }
+
+      BOOST_FOREACH(cellid_t p,path) own[p] = o;
+    }
+
+    BOOST_FOREACH(cellid_t c,cells)
+      ds.m_cell_own[ds.own_idx(c)] = own[c];
+  }
+
+  /// \brief The cp of the critical cell c in the msc of work/update
+  inline int ccell_cp(const dataset_t &ds,cellid_t c)
+  {
+    BOOST_AUTO(it,lower_bound(ds.m_ccells.begin(),ds.m_ccells.end(),c));
+
+    ASSERT(it != ds.m_ccells.end() && *it == c);
+
+    return ds.m_ccell_cps[it - ds.m_ccells.begin()];
+  }
+
+  /// \brief Remove all the connections of cp p
+  inline void disconnect_all(mscomplex_t &msc,int p)
+  {
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+      while(!msc.m_conn[dir][p].empty())
+        msc.disconnect_cps(p,*msc.m_conn[dir][p].begin());
+  }
+
+  void dataset_t::update(const cellid_list_t &verts,mscomplex_ptr_t msc)
+  {
+    ENSURE(m_ccells.size() != 0,"update needs an earlier work()");
+    ENSURE(m_gradient == GRAD_PASSES,"update is only done for the passes gradient");
+
+    // A max facet depends on the fns of the cell's verts. A vert pair
+    // depends on the max facets of its star, so on its one ring. An edge
+    // pair depends on the pairs of its tris' other edges and verts. So
+    // pairs are redone for the verts within two rings of the changed ones
+    // and for the edges of their stars.
+    cellid_list_t v0(verts),v2(verts),e0,t0,e2,t2;
+
+    grow_vert_rings(*m_tcc,v0,0);
+    grow_vert_rings(*m_tcc,v2,2);
+    collect_star(*m_tcc,v0,e0,t0);
+    collect_star(*m_tcc,v2,e2,t2);
+
+    BOOST_FOREACH(cellid_t c,e0) m_cell_flags[c] &= CS_BOUNDRY;
+    BOOST_FOREACH(cellid_t c,t0) m_cell_flags[c] &= CS_BOUNDRY;
+
+    assign_max_facets<1>(*this,e0.begin(),e0.end());
+    assign_max_facets<2>(*this,t0.begin(),t0.end());
+
+    // undo the pairs that these verts and edges made. Verts first, as the
+    // pair of a vert is found from its edges.
+    BOOST_FOREACH(cellid_t v,v2)
+      if(is_paired(v))
+      {
+        cellid_t p = pair(v);
+        m_cell_pairs[p] = m_cell_pairs[v] = CS_PAIR_NONE;
+      }
+
+    BOOST_FOREACH(cellid_t e,e2)
+      if((m_cell_pairs[e] & CS_PAIR_MASK) == CS_PAIR_COFCT)
+      {
+        cellid_t p = pair(e);
+        m_cell_pairs[p] = m_cell_pairs[e] = CS_PAIR_NONE;
+      }
+
+    assign_pairs<0>(*this,v2.begin(),v2.end());
+    assign_pairs<1>(*this,e2.begin(),e2.end());
+    assign_pairs2<1>(*this,e2.begin(),e2.end());
+
+    // only cells of the region can have become critical or paired
+    cellid_list_t rgn,ccells;
+
+    rgn.insert(rgn.end(),v2.begin(),v2.end());
+    rgn.insert(rgn.end(),e2.begin(),e2.end());
+    rgn.insert(rgn.end(),t2.begin(),t2.end());
+
+    set_difference(m_ccells.begin(),m_ccells.end(),rgn.begin(),rgn.end(),
+                   back_inserter(ccells));
+
+    int n = ccells.size();
+    collect_cps(*this,rgn.begin(),rgn.end(),back_inserter(ccells));
+    inplace_merge(ccells.begin(),ccells.begin()+n,ccells.end());
+    m_ccells.swap(ccells); // ccells now holds the old critical cells
+
+    cellid_list_t vown,town,dirty;
+
+    update_owners<ASC>(*this,v2,vown);
+    update_owners<DES>(*this,t2,town);
+
+    // saddles next to a cell with a new owner. The region's saddles are
+    // among them, as their verts are seeds.
+    cellid_t f[40];
+
+    BOOST_FOREACH(cellid_t c,vown)
+      for(int k = 0,n = get_cets<ASC>(c,f); k < n; ++k)
+        if(is_critical(f[k])) dirty.push_back(f[k]);
+
+    BOOST_FOREACH(cellid_t c,town)
+      for(int k = 0,n = get_cets<DES>(c,f); k < n; ++k)
+        if(is_critical(f[k])) dirty.push_back(f[k]);
+
+    sort(dirty.begin(),dirty.end());
+    dirty.erase(unique(dirty.begin(),dirty.end()),dirty.end());
+
+    // cps of cells that stay critical keep their numbers. The new ones
+    // take the slots of dead ones, those of the removed ones first.
+    int_list_t ocps,dead,added;
+
+    m_ccell_cps.swap(ocps);
+
+    int on = ccells.size(), nn = msc->get_num_critpts();
+
+    ENSURE(nn == on + m_free_cps.size(),"msc was not made by this dataset");
+
+    m_ccell_cps.assign(m_ccells.size(),-1);
+
+    for(int i = 0,j = 0 ; i < on || j < m_ccells.size();)
+    {
+      if(j == m_ccells.size() || (i < on && ccells[i] < m_ccells[j]))
+      {
+        ENSURE(msc->cellid(ocps[i]) == ccells[i],"msc was not made by this dataset");
+        dead.push_back(ocps[i++]);
+      }
+      else if(i == on || m_ccells[j] < ccells[i])
+        added.push_back(j++);
+      else
+        m_ccell_cps[j++] = ocps[i++];
+    }
+
+    m_free_cps.insert(m_free_cps.end(),dead.begin(),dead.end());
+
+    BOOST_FOREACH(int j,added)
+    {
+      if(m_free_cps.size() != 0)
+      {
+        m_ccell_cps[j] = m_free_cps.back();
+        m_free_cps.pop_back();
+      }
+      else
+        m_ccell_cps[j] = nn++;
+    }
+
+    // undo the cancellations around the cps whose fns or connections change
+    int_list_t cps(dead);
+
+    BOOST_FOREACH(cellid_t c,rgn)
+      if(is_critical(c)) cps.push_back(ccell_cp(*this,c));
+
+    BOOST_FOREACH(cellid_t c,dirty)
+    {
+      cps.push_back(ccell_cp(*this,c));
+
+      for(int k = 0,n = get_cets<DES>(c,f); k < n; ++k)
+        cps.push_back(ccell_cp(*this,m_cell_own[own_idx(f[k])]));
+
+      for(int k = 0,n = get_cets<ASC>(c,f); k < n; ++k)
+        cps.push_back(ccell_cp(*this,m_cell_own[own_idx(f[k])]));
+    }
+
+    cps.erase(remove_if(cps.begin(),cps.end(),
+                        bind(greater_equal<int>(),_1,msc->get_num_critpts())),
+              cps.end());
+
+    mscomplex_edit_t edit(*msc,cps);
+
+    msc->resize(nn);
+
+    BOOST_FOREACH(cellid_t c,dirty)
+      disconnect_all(*msc,ccell_cp(*this,c));
+
+    // removed cps are left dead: paired to themselves, with no connections
+    sort(dead.begin(),dead.end());
+
+    BOOST_FOREACH(int p,dead)
+    {
+      for(int dir = 0 ; dir < GDIR_CT; ++dir)
+        BOOST_FOREACH(int q,msc->m_conn[dir][p])
+          ENSURE(msc->index(p) == 1 || binary_search(dead.begin(),dead.end(),q),
+                 "a saddle of a removed extremum was not reconnected");
+
+      disconnect_all(*msc,p);
+    }
+
+    BOOST_FOREACH(int p,dead)
+      msc->m_cp_pair_idx[p] = p;
+
+    BOOST_FOREACH(cellid_t c,rgn)
+      if(is_critical(c))
+      {
+        int p = ccell_cp(*this,c);
+
+        msc->set_critpt(p,c,cell_dim(c),fn<CFI_MAX>(c),max_vert<-1>(c),is_boundry(c));
+        msc->m_cp_pair_idx[p] = -1;
+      }
+
+    BOOST_FOREACH(cellid_t c,dirty)
+    {
+      int p = ccell_cp(*this,c);
+
+      for(int k = 0,n = get_cets<DES>(c,f); k < n; ++k)
+        msc->connect_cps(p,ccell_cp(*this,m_cell_own[own_idx(f[k])]));
+
+      for(int k = 0,n = get_cets<ASC>(c,f); k < n; ++k)
+        msc->connect_cps(p,ccell_cp(*this,m_cell_own[own_idx(f[k])]));
+    }
+
+    edit.commit();
   }
 
 //  template<typename T>
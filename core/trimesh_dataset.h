@@ -22,19 +22,61 @@
 #ifndef TRIMESH_DATASET_H_INCLUDED
 #define TRIMESH_DATASET_H_INCLUDED
 
+#include <stdint.h>
+
 #include <trimesh.h>
 
 #include <boost/iterator/counting_iterator.hpp>
 
 namespace trimesh
 {
+  typedef std::vector<uint8_t> cell_state_list_t;
+  typedef std::vector<uint32_t> rank_list_t;
+
   class dataset_t
   {
   public:
+    /// \brief Bits of the per cell state bytes
+    /// \note  A max facet or a pair is stored as its index among the
+    ///        facets or cofacets of the cell, as listed by tri_cc_t. A vert
+    ///        paired to an edge stores no index. Its pair is the edge of its
+    ///        star that is paired down to it.
+    enum
+    {
+      CS_MXFCT_MASK = 0x03, // m_cell_flags : index of the max facet
+      CS_HAS_MXFCT  = 0x04, // m_cell_flags : max facet is assigned
+      CS_BOUNDRY    = 0x08, // m_cell_flags : cell is on the boundary
+      CS_PAIR_MASK  = 0x03, // m_cell_pairs : one of the below
+      CS_PAIR_NONE  = 0x00, //                critical
+      CS_PAIR_FCT   = 0x01, //                paired to a facet
+      CS_PAIR_COFCT = 0x02, //                paired to a cofacet
+      CS_PAIR_SHIFT = 2,    // m_cell_pairs : index of the pair above this
+    };
+
+    /// \brief How work_gradient pairs the cells
+    enum eGradient
+    {
+      GRAD_PASSES,     // max facets, then the pairs of each dim over all cells
+      GRAD_LOWER_STAR, // each vert's lower star on its own (ProcessLowerStars)
+    };
+
     const fn_list_t    &m_vert_fns;
+
+    // The flags are written by the max facet passes and read by the pairing
+    // passes. So they are kept apart from the pairs. Owners are only needed
+    // for the verts and the tris and are stored for those alone.
+    cell_state_list_t   m_cell_flags;
+    cell_state_list_t   m_cell_pairs;
     cellid_list_t       m_cell_own;
-    cellid_list_t       m_cell_pairs;
-    cellid_list_t       m_cell_mxfct;
+    cellid_list_t       m_ccells;   // critical cells in order.. kept for update
+    int_list_t          m_ccell_cps;// their cps in the msc of work/update
+    int_list_t          m_free_cps; // dead cps of that msc (see update)
+
+    // Rank of each cell among those of its dim in the order of
+    // compare_cells_fn. Only held through work_gradient.
+    rank_list_t         m_cell_rank;
+
+    eGradient           m_gradient;
 
     boost::shared_ptr<tri_cc_t> m_tcc;
 
@@ -48,6 +90,33 @@ namespace trimesh
   public:
     void  work(mscomplex_ptr_t);
 
+    /// \brief Just the max facet and pairing stage of work()
+    void  work_gradient();
+
+    /// \note  The lower star gradient is a different gradient of the same
+    ///        fn. Its critical cells may differ, but not its homology.
+    inline void set_gradient(eGradient g) {m_gradient = g;}
+    inline eGradient get_gradient() const {return m_gradient;}
+    static eGradient gradient_from_string(const std::string &s);
+
+    /// \brief Redo work() after the fns of the given verts have changed in
+    ///        the fn list that this dataset was made with
+    /// \note  Only the gradient within two rings of the verts is redone, and
+    ///        only the owners of cells whose gradient paths pass through that
+    ///        region. msc, as made by work() or update() and maybe simplified
+    ///        since, is patched in place. Cps of cells that stay critical
+    ///        keep their numbers. Removed ones are left dead (paired to
+    ///        themselves, with no connections) and new ones take dead slots
+    ///        or are appended. Only the saddles next to cells with new owners
+    ///        are reconnected, and only the cancellations around the changed
+    ///        cps are undone and redone (see mscomplex_edit_t). msc is left
+    ///        at its coarsest version. Only done for GRAD_PASSES.
+    /// \note  Not all of it is local. The critical cells, and the
+    ///        cancellations, are still scanned and merged in flat passes over
+    ///        all of msc, though with no replay. Checkpoints and collected
+    ///        manifolds are dropped, so collect_mfolds is a full rerun.
+    void  update(const cellid_list_t &verts,mscomplex_ptr_t msc);
+
   public:
     inline int cell_dim(cellid_t) const;
     inline bool is_boundry(cellid_t) const;
@@ -62,16 +131,23 @@ namespace trimesh
     inline uint get_points(cellid_t c,cellid_t *pts) const;
 
 
-    inline const cellid_t& max_fct(cellid_t ) const;
-    inline cellid_t& max_fct(cellid_t );
+    inline cellid_t max_fct(cellid_t ) const;
+    inline void max_fct(cellid_t,cellid_t );
     template <int dim> inline cellid_t max_vert(cellid_t c) const;
 
     enum eCellFnInterpolant {CFI_MAX,CFI_AVE};
     template<eCellFnInterpolant CFI> inline fn_t fn(cellid_t c) const;
 
+    /// \brief Order of the dim cells.. from m_cell_rank if it is held
     template <int dim>
     inline bool compare_cells(const cellid_t & c1, const cellid_t &c2) const;
 
+    /// \brief Order of the dim cells from the fns of their verts
+    /// \note  Cells are compared by their max facets, then by the verts
+    ///        opposite them (boundary ones first), and verts by fn and id.
+    template <int dim>
+    inline bool compare_cells_fn(const cellid_t & c1, const cellid_t &c2) const;
+
     template <int di,int dj>
     inline bool compare_cells(const cellid_t & c1, const cellid_t &c2) const;
 
@@ -83,17 +159,42 @@ namespace trimesh
 
 
 
-    inline const cellid_t& pair(cellid_t ) const;
+    inline cellid_t pair(cellid_t ) const;
     inline void pair(cellid_t,cellid_t );
     inline bool is_paired(cellid_t) const;
     inline bool is_critical(cellid_t) const;
 
     inline const cellid_t& owner(cellid_t ) const;
     inline cellid_t& owner(cellid_t );
+    inline int own_idx(cellid_t ) const; // index into m_cell_own
+
+    /// \brief Bytes held by the per cell state
+    size_t state_bytes() const;
+
+    /// \brief Code the pairs in 2 bits per edge and then per tri: 1 + the
+    ///        index of the facet the cell is paired to, 0 if none. Four
+    ///        cells a byte, low bits first.
+    /// \note  Verts take no bits. A vert's pair is the edge paired to it.
+    void encode_gradient(std::vector<uint8_t> &code) const;
+
+    /// \brief Take the pairs from the n bytes of code in place of
+    ///        work_gradient. The critical cells and owners are then found
+    ///        as in work().
+    /// \note  Only the gradient is read. So the fns may be left empty if
+    ///        just manifolds and labels are wanted.
+    void decode_gradient(const uint8_t *code,size_t n);
 
     template <eGDIR dir,typename rng_t>
     inline void get_mfold(mfold_t &,rng_t rng);
 
+  private:
+    void init_cell_state();
+
+    /// \brief Fill m_cell_rank from the vert fns
+    void rank_cells();
+
+    inline int facet_idx(cellid_t c,cellid_t f) const;
+    inline cellid_t vert_pair(cellid_t v) const;
 
   };
 }
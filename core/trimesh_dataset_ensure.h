@@ -15,7 +15,7 @@ namespace trimesh
   {return m_tcc->get_cell_dim(c);}
 
   inline bool dataset_t::is_boundry(cellid_t c) const
-  {return m_tcc->is_cell_boundry(c);}
+  {return (m_cell_flags[c] & CS_BOUNDRY) != 0;}
 
   template<>
   inline uint dataset_t::get_cets<DES>(cellid_t c,cellid_t *cets) const
@@ -39,11 +39,24 @@ namespace trimesh
 
 
 
-  inline const cellid_t& dataset_t::max_fct(cellid_t c) const
-  {ASSERT(m_cell_mxfct[c] != invalid_cellid);return m_cell_mxfct[c];}
+  inline int dataset_t::facet_idx(cellid_t c,cellid_t f) const
+  {
+    int k = 0;
+    while(m_tcc->get_cell_facet(c,k) != f) ++k;
+    return k;
+  }
 
-  inline cellid_t& dataset_t::max_fct(cellid_t c)
-  {ASSERT(m_cell_mxfct[c] == invalid_cellid);return m_cell_mxfct[c];}
+  inline cellid_t dataset_t::max_fct(cellid_t c) const
+  {
+    ASSERT(m_cell_flags[c] & CS_HAS_MXFCT);
+    return m_tcc->get_cell_facet(c,m_cell_flags[c] & CS_MXFCT_MASK);
+  }
+
+  inline void dataset_t::max_fct(cellid_t c,cellid_t f)
+  {
+    ASSERT(!(m_cell_flags[c] & CS_HAS_MXFCT));
+    m_cell_flags[c] |= CS_HAS_MXFCT | facet_idx(c,f);
+  }
 
   template <int dim> inline cellid_t dataset_t::max_vert(cellid_t c) const
   {return max_vert<dim-1>(max_fct(c));}
@@ -83,12 +96,21 @@ namespace trimesh
 
   template <int dim>
   inline bool dataset_t::compare_cells(const cellid_t & c1, const cellid_t &c2) const
+  {
+    if(!m_cell_rank.empty())
+      return m_cell_rank[c1] < m_cell_rank[c2];
+
+    return compare_cells_fn<dim>(c1,c2);
+  }
+
+  template <int dim>
+  inline bool dataset_t::compare_cells_fn(const cellid_t & c1, const cellid_t &c2) const
   {
     cellid_t f1 = max_fct(c1);
     cellid_t f2 = max_fct(c2);
 
     if(f1 != f2)
-      return compare_cells<dim-1>(f1,f2);
+      return compare_cells_fn<dim-1>(f1,f2);
 
     f1 = m_tcc->get_opp_cell(f1,c1);
     f2 = m_tcc->get_opp_cell(f2,c2);
@@ -99,11 +121,11 @@ namespace trimesh
     if(is_bnd_f1 != is_bnd_f2)
       return (is_bnd_f1);
 
-    return compare_cells<0>(f1,f2);
+    return compare_cells_fn<0>(f1,f2);
   }
 
   template <>
-  inline bool dataset_t::compare_cells<0>(const cellid_t & c1, const cellid_t &c2) const
+  inline bool dataset_t::compare_cells_fn<0>(const cellid_t & c1, const cellid_t &c2) const
   {
     ASSERT(m_tcc->get_cell_dim(c1) == 0);
     ASSERT(m_tcc->get_cell_dim(c2) == 0);
@@ -162,24 +184,71 @@ namespace trimesh
 
 
 
-  inline const cellid_t& dataset_t::pair(cellid_t c) const
-  {ASSERT(m_cell_pairs[c] != invalid_cellid);return m_cell_pairs[c];}
+  inline cellid_t dataset_t::vert_pair(cellid_t v) const
+  {
+    cellid_t cf[20];
+    int n = m_tcc->get_cell_co_facets(v,cf);
+
+    for(int i = 0 ; i < n; ++i)
+    {
+      uint8_t s = m_cell_pairs[cf[i]];
+
+      if((s & CS_PAIR_MASK) == CS_PAIR_FCT &&
+         m_tcc->get_cell_facet(cf[i],s >> CS_PAIR_SHIFT) == v)
+        return cf[i];
+    }
+
+    ASSERT(false&&"paired vert has no edge paired to it");
+    return invalid_cellid;
+  }
+
+  inline cellid_t dataset_t::pair(cellid_t c) const
+  {
+    ASSERT(is_paired(c));
+
+    uint8_t s = m_cell_pairs[c];
+
+    if((s & CS_PAIR_MASK) == CS_PAIR_FCT)
+      return m_tcc->get_cell_facet(c,s >> CS_PAIR_SHIFT);
+
+    if(c < m_tcc->vert_ct())
+      return vert_pair(c);
+
+    return m_tcc->get_cell_co_facet(c,s >> CS_PAIR_SHIFT);
+  }
 
   inline void dataset_t::pair(cellid_t c,cellid_t p)
-  {ASSERT(m_cell_pairs[c] == invalid_cellid);m_cell_pairs[c] = p;
-   ASSERT(m_cell_pairs[p] == invalid_cellid);m_cell_pairs[p] = c;}
+  {
+    if(cell_dim(c) > cell_dim(p))
+      std::swap(c,p);
+
+    ASSERT(cell_dim(c)+1 == cell_dim(p));
+    ASSERT(is_critical(c) && is_critical(p));
+
+    m_cell_pairs[p] = CS_PAIR_FCT | (facet_idx(p,c) << CS_PAIR_SHIFT);
+    m_cell_pairs[c] = CS_PAIR_COFCT;
+
+    if(c >= m_tcc->vert_ct() && m_tcc->get_cell_co_facet(c,0) != p)
+      m_cell_pairs[c] |= 1 << CS_PAIR_SHIFT;
+  }
 
   inline bool dataset_t::is_paired(cellid_t c) const
-  {return m_cell_pairs[c] != invalid_cellid;}
+  {return (m_cell_pairs[c] & CS_PAIR_MASK) != CS_PAIR_NONE;}
 
   inline bool dataset_t::is_critical(cellid_t c) const
-  {return m_cell_pairs[c] == invalid_cellid;}
+  {return (m_cell_pairs[c] & CS_PAIR_MASK) == CS_PAIR_NONE;}
+
+  inline int dataset_t::own_idx(cellid_t c) const
+  {
+    ASSERT(cell_dim(c) != 1);
+    return (c < m_tcc->vert_ct())?(c):(c - m_tcc->edge_ct());
+  }
 
   inline const cellid_t& dataset_t::owner(cellid_t c) const
-  {ASSERT(m_cell_own[c] != invalid_cellid);return m_cell_own[c];}
+  {ASSERT(m_cell_own[own_idx(c)] != invalid_cellid);return m_cell_own[own_idx(c)];}
 
   inline cellid_t& dataset_t::owner(cellid_t c)
-  {ASSERT(m_cell_own[c] == invalid_cellid);return m_cell_own[c];}
+  {ASSERT(m_cell_own[own_idx(c)] == invalid_cellid);return m_cell_own[own_idx(c)];}
 
   template <eGDIR dir,typename rng_t>
   inline void dataset_t::get_mfold(mfold_t &mfold,rng_t rng)
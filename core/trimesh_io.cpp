@@ -0,0 +1,489 @@
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/static_assert.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <trimesh_io.h>
+
+using namespace std;
+
+namespace ba = boost::algorithm;
+
+namespace trimesh
+{
+
+/*===========================================================================*/
+
+static const char     mesh_bin_magic[8]  = {'M','S','T','R','I','M','S','H'};
+static const uint32_t mesh_bin_version   = 1;
+
+struct mesh_bin_header_t
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t num_verts;
+  uint32_t num_tris;
+  uint32_t reserved;
+};
+
+/*---------------------------------------------------------------------------*/
+
+mapped_file_t::mapped_file_t(const string &f,bool sequential)
+  :m_data(0),m_size(0)
+{
+  int fd = open(f.c_str(),O_RDONLY);
+
+  ENSUREV(fd != -1,"unable to open file",f);
+
+  struct stat st;
+
+  if(fstat(fd,&st) == 0 && st.st_size > 0)
+  {
+    m_size = st.st_size;
+    m_data = mmap(0,m_size,PROT_READ,MAP_PRIVATE,fd,0);
+  }
+
+  close(fd);
+
+  ENSUREV(m_data != 0 && m_data != MAP_FAILED,"unable to map file",f);
+
+  madvise(m_data,m_size,(sequential)?(MADV_SEQUENTIAL):(MADV_RANDOM));
+}
+
+/*---------------------------------------------------------------------------*/
+
+mapped_file_t::~mapped_file_t()
+{munmap(m_data,m_size);}
+
+/*---------------------------------------------------------------------------*/
+
+mesh_bin_view_t::mesh_bin_view_t(const string &f):
+  m_file(new mapped_file_t(f)),m_filename(f)
+{
+  mesh_bin_header_t hdr;
+
+  ENSUREV(m_file->size() >= sizeof(hdr),"truncated mesh bin file",f);
+
+  memcpy(&hdr,m_file->data(),sizeof(hdr));
+
+  ENSUREV(memcmp(hdr.magic,mesh_bin_magic,sizeof(hdr.magic)) == 0,
+          "Doesn't seem to be a mesh bin file",f);
+  ENSUREV(hdr.version == mesh_bin_version,
+          "unsupported mesh bin version",hdr.version);
+
+  size_t fns_sz  = size_t(hdr.num_verts)*sizeof(double);
+  size_t tris_sz = size_t(hdr.num_tris)*3*sizeof(uint32_t);
+
+  ENSUREV(m_file->size() == sizeof(hdr) + fns_sz + tris_sz,
+          "mesh bin file size does not match its header",f);
+
+  m_num_verts = hdr.num_verts;
+  m_num_tris  = hdr.num_tris;
+  m_fns       = (const double*)(m_file->data() + sizeof(hdr));
+  m_tris      = (const uint*)(m_file->data() + sizeof(hdr) + fns_sz);
+}
+
+/*---------------------------------------------------------------------------*/
+
+mesh_bin_view_t::~mesh_bin_view_t(){}
+
+/*---------------------------------------------------------------------------*/
+
+void read_mesh_bin(const string &f, fn_list_t &fns, tri_idx_list_t &tlist)
+{
+  mesh_bin_view_t mv(f);
+
+  fns.resize(mv.num_verts());
+  tlist.resize(mv.num_tris());
+
+  memcpy(fns.data(),mv.fns(),fns.size()*sizeof(double));
+
+  // tri_idx_t is a packed array of 3 uints, so the tris are copied in bulk
+  BOOST_STATIC_ASSERT(sizeof(tri_idx_t) == 3*sizeof(uint32_t));
+
+  memcpy((void*)tlist.data(),mv.tri(0),tlist.size()*sizeof(tri_idx_t));
+}
+
+/*---------------------------------------------------------------------------*/
+
+void write_mesh_bin(const string &f, const fn_list_t &fns,
+                    const tri_idx_list_t &tlist)
+{
+  fstream fs(f.c_str(),ios::out|ios::binary);
+
+  ENSUREV(fs.is_open(),"unable to open file for writing",f);
+
+  mesh_bin_header_t hdr;
+
+  memcpy(hdr.magic,mesh_bin_magic,sizeof(hdr.magic));
+  hdr.version   = mesh_bin_version;
+  hdr.num_verts = fns.size();
+  hdr.num_tris  = tlist.size();
+  hdr.reserved  = 0;
+
+  fs.write((const char*)&hdr,sizeof(hdr));
+  fs.write((const char*)fns.data(),fns.size()*sizeof(double));
+  fs.write((const char*)tlist.data(),tlist.size()*sizeof(tri_idx_t));
+
+  ENSUREV(fs.good(),"failed writing mesh bin file",f);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static const char     mesh_vtri_magic[8] = {'M','S','T','R','I','V','T','X'};
+static const uint32_t mesh_vtri_version  = 1;
+
+inline size_t mesh_vtri_size(uint num_verts,uint num_tris)
+{
+  return sizeof(mesh_bin_header_t) + size_t(num_verts+1)*sizeof(uint64_t) +
+      size_t(num_tris)*3*sizeof(uint32_t);
+}
+
+void write_mesh_vtri(const mesh_bin_view_t &mesh, const string &f)
+{
+  const uint V = mesh.num_verts(),T = mesh.num_tris();
+
+  for(uint t = 0 ; t < T; ++t)
+    for(int k = 0 ; k < 3; ++k)
+      ENSUREV(mesh.tri(t)[k] < V,"invalid vertex index in mesh",mesh.tri(t)[k]);
+
+  // written under a temporary name, so that a reader never maps a part file
+  std::stringstream tf;
+  tf << f << "." << getpid() << ".tmp";
+
+  const size_t size = mesh_vtri_size(V,T);
+
+  int fd = open(tf.str().c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+
+  ENSUREV(fd != -1,"unable to open file for writing",tf.str());
+
+  void *p = MAP_FAILED;
+
+  if(ftruncate(fd,size) == 0)
+    p = mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+
+  close(fd);
+
+  if(p == MAP_FAILED)
+    unlink(tf.str().c_str());
+
+  ENSUREV(p != MAP_FAILED,"unable to map file for writing",tf.str());
+
+  mesh_bin_header_t hdr;
+
+  memcpy(hdr.magic,mesh_vtri_magic,sizeof(hdr.magic));
+  hdr.version   = mesh_vtri_version;
+  hdr.num_verts = V;
+  hdr.num_tris  = T;
+  hdr.reserved  = 0;
+
+  memcpy(p,&hdr,sizeof(hdr));
+
+  uint64_t *offs = (uint64_t*)((char*)p + sizeof(hdr));
+  uint32_t *tris = (uint32_t*)(offs + V + 1);
+
+  // the file is zero filled. Count the tris of v into offs[v+1] and sum,
+  // then fill using offs[v] as v's cursor, which leaves offs shifted down
+  // by one.
+  for(uint t = 0 ; t < T; ++t)
+    for(int k = 0 ; k < 3; ++k)
+      ++offs[mesh.tri(t)[k]+1];
+
+  for(uint v = 0 ; v < V; ++v)
+    offs[v+1] += offs[v];
+
+  for(uint t = 0 ; t < T; ++t)
+    for(int k = 0 ; k < 3; ++k)
+      tris[offs[mesh.tri(t)[k]]++] = t;
+
+  for(uint v = V ; v > 0; --v)
+    offs[v] = offs[v-1];
+
+  offs[0] = 0;
+
+  bool is_ok = munmap(p,size) == 0 && rename(tf.str().c_str(),f.c_str()) == 0;
+
+  if(!is_ok)
+    unlink(tf.str().c_str());
+
+  ENSUREV(is_ok,"failed writing mesh vtri file",f);
+}
+
+/*---------------------------------------------------------------------------*/
+
+inline bool is_mesh_vtri_current(const mesh_bin_view_t &mesh, const string &f)
+{
+  struct stat mst,vst;
+
+  // the index must be strictly newer, as a mesh rewritten within one clock
+  // tick of its index would otherwise pass
+  if(stat(mesh.filename().c_str(),&mst) != 0 || stat(f.c_str(),&vst) != 0 ||
+     make_pair(vst.st_mtim.tv_sec,vst.st_mtim.tv_nsec) <=
+     make_pair(mst.st_mtim.tv_sec,mst.st_mtim.tv_nsec) ||
+     size_t(vst.st_size) != mesh_vtri_size(mesh.num_verts(),mesh.num_tris()))
+    return false;
+
+  mesh_bin_header_t hdr;
+
+  fstream fs(f.c_str(),ios::in|ios::binary);
+  fs.read((char*)&hdr,sizeof(hdr));
+
+  return fs.good() && memcmp(hdr.magic,mesh_vtri_magic,sizeof(hdr.magic)) == 0 &&
+      hdr.version == mesh_vtri_version && hdr.num_verts == mesh.num_verts() &&
+      hdr.num_tris == mesh.num_tris();
+}
+
+/*---------------------------------------------------------------------------*/
+
+mesh_vtri_view_t::mesh_vtri_view_t(const mesh_bin_view_t &mesh)
+{
+  string f = mesh.filename() + ".vtri";
+
+  if(!is_mesh_vtri_current(mesh,f))
+    write_mesh_vtri(mesh,f);
+
+  m_file.reset(new mapped_file_t(f,false));
+
+  ENSUREV(m_file->size() == mesh_vtri_size(mesh.num_verts(),mesh.num_tris()),
+          "mesh vtri file size does not match its mesh",f);
+
+  m_offs = (const uint64_t*)(m_file->data() + sizeof(mesh_bin_header_t));
+  m_tris = (const uint*)(m_offs + mesh.num_verts() + 1);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static const char     labels_bin_magic[8] = {'M','S','T','R','I','L','B','L'};
+static const uint32_t labels_bin_version  = 1;
+
+void write_labels_bin(const string &f,const int_list_t &vert_min,
+                      const int_list_t &edge_des,const int_list_t &edge_asc,
+                      const int_list_t &tri_max)
+{
+  ENSURE(edge_des.size() == edge_asc.size(),"edge label counts differ");
+
+  fstream fs(f.c_str(),ios::out|ios::binary);
+
+  ENSUREV(fs.is_open(),"unable to open file for writing",f);
+
+  uint32_t hdr[4] = {labels_bin_version,uint32_t(vert_min.size()),
+                     uint32_t(edge_des.size()),uint32_t(tri_max.size())};
+
+  fs.write(labels_bin_magic,sizeof(labels_bin_magic));
+  fs.write((const char*)hdr,sizeof(hdr));
+  fs.write((const char*)vert_min.data(),vert_min.size()*sizeof(int32_t));
+  fs.write((const char*)edge_des.data(),edge_des.size()*sizeof(int32_t));
+  fs.write((const char*)edge_asc.data(),edge_asc.size()*sizeof(int32_t));
+  fs.write((const char*)tri_max.data(),tri_max.size()*sizeof(int32_t));
+
+  ENSUREV(fs.good(),"failed writing label file",f);
+}
+
+/*===========================================================================*/
+
+
+
+
+/*===========================================================================*/
+
+inline bool is_blank(char c) {return c == ' ' || c == '\t' || c == '\r';}
+
+inline const char * skip_blanks(const char *p)
+{while(is_blank(*p)) ++p; return p;}
+
+inline const char * skip_token(const char *p)
+{while(*p && !is_blank(*p) && *p != '\n') ++p; return p;}
+
+inline const char * next_line(const char *p)
+{while(*p && *p != '\n') ++p; return (*p)?(p+1):(p);}
+
+inline const char * parse_uint(const char *p, uint &v)
+{
+  p = skip_blanks(p);
+
+  const char *b = p;
+
+  for(v = 0; '0' <= *p && *p <= '9'; ++p)
+    v = v*10 + (*p - '0');
+
+  ENSURES(p != b) << "expected an integer in off file\n";
+
+  return p;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void read_off_file(const string &f, std::vector<fn_list_t> &fns,
+                   tri_idx_list_t &tlist, const int_list_t &comps)
+{
+  ENSURE(comps.size() > 0,"no vertex components requested");
+
+  // The file is copied into a nul terminated buffer, so that strtod can
+  // safely run up to the end of the last token.
+  vector<char> buf;
+
+  {
+    mapped_file_t mf(f);
+    buf.resize(mf.size()+1);
+    memcpy(buf.data(),mf.data(),mf.size());
+    buf[mf.size()] = 0;
+  }
+
+  const char *p = skip_blanks(buf.data());
+
+  ENSURE(strncmp(p,"OFF",3) == 0 && (p[3] == '\n' || is_blank(p[3])),
+         "Doesn't seem to be an OFF FILE");
+
+  p = next_line(p);
+
+  uint num_v,num_t;
+
+  p = parse_uint(p,num_v);
+  p = parse_uint(p,num_t);
+  p = next_line(p);
+
+  int num_c = 0;
+
+  for(int k = 0 ; k < comps.size(); ++k)
+  {
+    ENSUREV(comps[k] >= 0,"invalid vertex component",comps[k]);
+    num_c = std::max(num_c,comps[k]+1);
+  }
+
+  std::vector<bool> need(num_c,false);
+  fn_list_t         vals(num_c);
+
+  for(int k = 0 ; k < comps.size(); ++k)
+    need[comps[k]] = true;
+
+  fns.resize(comps.size());
+
+  for(int k = 0 ; k < comps.size(); ++k)
+    fns[k].resize(num_v);
+
+  tlist.resize(num_t);
+
+  for ( uint i = 0; i < num_v; ++i )
+  {
+    p = skip_blanks(p);
+
+    for(int j = 0 ; j < num_c; ++j)
+    {
+      // strtod would skip the newline and read on into the next line
+      char *e = (char*)p;
+
+      if(*p && *p != '\n')
+      {
+        if(need[j])
+          vals[j] = strtod(p,&e);
+        else
+          e = (char*)skip_token(p);
+      }
+
+      ENSURES(e != p) << "vertex line " << i << " has too few components\n";
+
+      p = skip_blanks(e);
+    }
+
+    for(int k = 0 ; k < comps.size(); ++k)
+      fns[k][i] = vals[comps[k]];
+
+    p = next_line(p);
+  }
+
+  for ( uint i = 0; i < num_t; i++ )
+  {
+    uint ntv;
+
+    p = parse_uint(p,ntv);
+    p = parse_uint(p,tlist[i][0]);
+    p = parse_uint(p,tlist[i][1]);
+    p = parse_uint(p,tlist[i][2]);
+    p = next_line(p);
+
+    ENSURE(ntv == 3,"Mesh contains non-triangle polys");
+    ENSURE(is_in_range(tlist[i][0],0,num_v),"invalid index in file");
+    ENSURE(is_in_range(tlist[i][1],0,num_v),"invalid index in file");
+    ENSURE(is_in_range(tlist[i][2],0,num_v),"invalid index in file");
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void read_off_file(const string &f, fn_list_t &fns,
+                   tri_idx_list_t &tlist, int compno)
+{
+  std::vector<fn_list_t> comp_fns;
+
+  read_off_file(f,comp_fns,tlist,int_list_t(1,compno));
+
+  fns.swap(comp_fns[0]);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void read_off_file_split(const string & fname, fn_list_t &fns,
+                         tri_idx_list_t &tlist ,int compno)
+{
+  fstream off_file ( fname.c_str(), fstream::in);
+
+  ENSURE(off_file.is_open(),"unable to open off file");
+
+  string ln;
+  std::vector<string> strs;
+
+  getline(off_file,ln);
+  ENSURE(ln=="OFF","Doesn't seem to be an OFF FILE");
+
+  getline(off_file,ln);
+  ba::split(strs,ln,ba::is_any_of("\t \n"));
+
+  int num_v = atoi(strs[0].c_str());
+  int num_t = atoi(strs[1].c_str());
+
+  fns.resize(num_v);
+  tlist.resize(num_t);
+
+  for ( uint i = 0; i < num_v; ++i )
+  {
+    getline(off_file,ln);
+    ba::split(strs,ln,ba::is_any_of("\t \n"));
+    fns[i] = atof(strs[compno].c_str());
+
+    ENSURE(is_in_range(compno,0,strs.size()),
+           "too few components in vinfo line");
+  }
+
+  for ( uint i = 0; i < num_t; i++ )
+  {
+    getline(off_file,ln);
+    ba::split(strs,ln,ba::is_any_of("\t \n"));
+
+    int ntv     = atoi(strs[0].c_str());
+    tlist[i][0] = atoi(strs[1].c_str());
+    tlist[i][1] = atoi(strs[2].c_str());
+    tlist[i][2] = atoi(strs[3].c_str());
+
+    ENSURE(ntv == 3,"Mesh contains non-triangle polys");
+    ENSURE(is_in_range(tlist[i][0],0,num_v),"invalid index in file");
+    ENSURE(is_in_range(tlist[i][1],0,num_v),"invalid index in file");
+    ENSURE(is_in_range(tlist[i][2],0,num_v),"invalid index in file");
+  }
+
+  off_file.close();
+}
+
+/*===========================================================================*/
+
+}
@@ -0,0 +1,158 @@
+#ifndef TRIMESH_IO_H_INCLUDED
+#define TRIMESH_IO_H_INCLUDED
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <trimesh.h>
+
+namespace trimesh
+{
+  /**
+    \brief Binary mesh files
+
+    A compact binary format holding the per vertex function and the
+    triangles of a mesh. Everything is little endian.
+
+    char     magic[8]   = "MSTRIMSH"
+    uint32   version    = 1
+    uint32   num_verts
+    uint32   num_tris
+    uint32   reserved   = 0
+    float64  fns[num_verts]
+    uint32   tris[3*num_tris]
+
+    The file is mmapped on load and each array is copied out in one go.
+  **/
+
+  /// \brief A read only mmap of a whole file
+  /// \note  The kernel is told whether the file is read front to back or
+  ///        at random, which sets how far it reads ahead.
+  class mapped_file_t : boost::noncopyable
+  {
+  public:
+    mapped_file_t(const std::string &f,bool sequential=true);
+    ~mapped_file_t();
+
+    inline const char * data() const {return (const char*)m_data;}
+    inline size_t size() const {return m_size;}
+
+  private:
+    void  *m_data;
+    size_t m_size;
+  };
+
+  /// \brief Random access to a binary mesh file through an mmap
+  /// \note  Pages are only read in when touched, so the mesh need not fit
+  ///        in memory.
+  class mesh_bin_view_t
+  {
+  public:
+    mesh_bin_view_t(const std::string &f);
+    ~mesh_bin_view_t();
+
+    inline uint num_verts() const {return m_num_verts;}
+    inline uint num_tris() const {return m_num_tris;}
+
+    inline fn_t fn(uint v) const {return m_fns[v];}
+    inline const fn_t * fns() const {return m_fns;}
+    inline const uint * tri(uint t) const {return m_tris + 3*t;}
+
+    inline const std::string & filename() const {return m_filename;}
+
+  private:
+    boost::shared_ptr<mapped_file_t> m_file;
+    std::string                      m_filename;
+
+    uint          m_num_verts;
+    uint          m_num_tris;
+    const double *m_fns;
+    const uint   *m_tris;
+  };
+
+  /// \brief Read a binary mesh file
+  void read_mesh_bin(const std::string &f, fn_list_t &fns, tri_idx_list_t &tlist);
+
+  /// \brief Write a binary mesh file
+  void write_mesh_bin(const std::string &f, const fn_list_t &fns,
+                      const tri_idx_list_t &tlist);
+
+  /**
+    \brief Vert to tri index files
+
+    The tris around each vert of a binary mesh file, kept next to it in
+    <mesh>.vtri. The tris of vert v are tris[offs[v] .. offs[v+1]), in
+    increasing order.
+
+    char     magic[8]   = "MSTRIVTX"
+    uint32   version    = 1
+    uint32   num_verts
+    uint32   num_tris
+    uint32   reserved   = 0
+    uint64   offs[num_verts+1]
+    uint32   tris[3*num_tris]
+  **/
+
+  /// \brief Write the vert to tri index of a mesh
+  /// \note  The file is filled through a shared mmap, so no per vert state
+  ///        is held in memory.
+  void write_mesh_vtri(const mesh_bin_view_t &mesh, const std::string &f);
+
+  /// \brief Random access to the vert to tri index of a mesh through an mmap
+  /// \note  <mesh>.vtri is (re)written first if it is missing, older than
+  ///        the mesh or made for another mesh.
+  class mesh_vtri_view_t
+  {
+  public:
+    mesh_vtri_view_t(const mesh_bin_view_t &mesh);
+
+    inline uint num_tris(uint v) const {return m_offs[v+1] - m_offs[v];}
+    inline const uint * tris(uint v) const {return m_tris + m_offs[v];}
+
+  private:
+    boost::shared_ptr<mapped_file_t> m_file;
+
+    const uint64_t *m_offs;
+    const uint     *m_tris;
+  };
+
+  /**
+    \brief Binary label files
+
+    Dense labels of the cells of a mesh. Each is the index of the
+    surviving cp whose manifold holds the cell, -1 if none. See
+    mscomplex_t::get_mfold_labels.
+
+    char     magic[8]   = "MSTRILBL"
+    uint32   version    = 1
+    uint32   num_verts
+    uint32   num_edges
+    uint32   num_tris
+    int32    vert_min[num_verts]   // asc manifolds of minima
+    int32    edge_des[num_edges]   // des manifolds (arcs) of saddles
+    int32    edge_asc[num_edges]   // asc manifolds (arcs) of saddles
+    int32    tri_max[num_tris]     // des manifolds of maxima
+  **/
+
+  /// \brief Write a binary label file
+  void write_labels_bin(const std::string &f,const int_list_t &vert_min,
+                        const int_list_t &edge_des,const int_list_t &edge_asc,
+                        const int_list_t &tri_max);
+
+  /// \brief Read the compno'th vertex component and the tris of an OFF file
+  /// \note  The whole file is read in one go and parsed in place.
+  void read_off_file(const std::string &f, fn_list_t &fns,
+                     tri_idx_list_t &tlist, int compno);
+
+  /// \brief Read the listed vertex components and the tris of an OFF file
+  /// \note  All components are gathered in a single pass over the file.
+  void read_off_file(const std::string &f, std::vector<fn_list_t> &fns,
+                     tri_idx_list_t &tlist, const int_list_t &comps);
+
+  // reference getline/split based off reader.. much slower.. kept for benchmarking
+  void read_off_file_split(const std::string &f, fn_list_t &fns,
+                           tri_idx_list_t &tlist, int compno);
+}
+
+#endif
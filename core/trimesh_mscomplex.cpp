@@ -1,4 +1,5 @@
 #include <cmath>
+#include <cstring>
 #include <queue>
 #include <limits>
 
@@ -14,9 +15,11 @@
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/set.hpp>
+#include <boost/static_assert.hpp>
 
 #include <trimesh_mscomplex.h>
 #include <trimesh_dataset.h>
+#include <trimesh_io.h>
 
 using namespace std;
 namespace br    = boost::range;
@@ -194,12 +197,94 @@ void merge_dag_t::serialize(Archive & ar, const unsigned int version)
 
 
 
+/*****************************************************************************/
+
+conn_t::conn_t():m_n(0),m_cap(s_ninline){}
+
+/*---------------------------------------------------------------------------*/
+
+conn_t::conn_t(const conn_t &o):m_n(0),m_cap(s_ninline)
+{
+  *this = o;
+}
+
+/*---------------------------------------------------------------------------*/
+
+conn_t & conn_t::operator=(const conn_t &o)
+{
+  if(this == &o)
+    return *this;
+
+  m_n = 0;
+
+  if(m_cap < o.m_n)
+    reserve(o.m_cap);
+
+  std::copy(o.data(),o.data() + o.m_n,data());
+  m_n = o.m_n;
+
+  return *this;
+}
+
+/*---------------------------------------------------------------------------*/
+
+conn_t::~conn_t()
+{
+  clear();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void conn_t::clear()
+{
+  if(m_cap != s_ninline)
+    delete []m_heap;
+
+  m_n   = 0;
+  m_cap = s_ninline;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void conn_t::reserve(uint cap)
+{
+  if(cap <= m_cap)
+    return;
+
+  entry_t *heap = new entry_t[cap];
+
+  std::copy(data(),data() + m_n,heap);
+
+  if(m_cap != s_ninline)
+    delete []m_heap;
+
+  m_heap = heap;
+  m_cap  = cap;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void conn_t::assign(const entry_t *b,const entry_t *e)
+{
+  m_n = 0;
+  reserve(e - b);
+
+  std::copy(b,e,data());
+  m_n = e - b;
+}
+
+/*****************************************************************************/
+
+
+
+
 /*****************************************************************************/
 
 mscomplex_t::mscomplex_t()
   :m_des_conn(m_conn[0]),m_asc_conn(m_conn[1]),
     m_des_mfolds(m_mfolds[0]),m_asc_mfolds(m_mfolds[1]),
     m_multires_version(0),
+    m_simp_tresh(-1),
     m_fmax(std::numeric_limits<fn_t>::min()),
     m_fmin(std::numeric_limits<fn_t>::max()),
     m_merge_dag(new merge_dag_t){}
@@ -210,6 +295,7 @@ mscomplex_t::mscomplex_t(std::string fname)
   :m_des_conn(m_conn[0]),m_asc_conn(m_conn[1]),
     m_des_mfolds(m_mfolds[0]),m_asc_mfolds(m_mfolds[1]),
     m_multires_version(0),
+    m_simp_tresh(-1),
     m_fmax(std::numeric_limits<fn_t>::min()),
     m_fmin(std::numeric_limits<fn_t>::max()),
     m_merge_dag(new merge_dag_t)
@@ -268,6 +354,12 @@ void mscomplex_t::clear()
   m_asc_conn.clear();
   m_des_mfolds.clear();
   m_asc_mfolds.clear();
+  m_canc_list.clear();
+  m_canc_pers.clear();
+  m_checkpoints.clear();
+  m_multires_version = 0;
+  m_simp_tresh       = -1;
+  m_merge_dag.reset(new merge_dag_t);
 
   m_fmax = std::numeric_limits<fn_t>::min();
   m_fmin = std::numeric_limits<fn_t>::max();
@@ -297,122 +389,138 @@ void mscomplex_t::disconnect_cps(int p, int q)
   ASSERT(is_not_paired(p) && is_not_paired(q));
   ASSERT(m_des_conn[p].count(q) == m_asc_conn[q].count(p));
 
-  m_des_conn[p].erase(m_des_conn[p].find(q));
-  m_asc_conn[q].erase(m_asc_conn[q].find(p));
+  m_des_conn[p].erase_one(q);
+  m_asc_conn[q].erase_one(p);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void mscomplex_t::cancel_pair ( int p, int q)
+/// \brief Check and record the cancellation of p and q
+inline void push_cancellation(mscomplex_t &msc,int p,int q)
 {
-  order_pr_by_cp_index(*this,p,q);
-
-  ENSURE(m_multires_version == m_canc_list.size(),
+  ENSURE(msc.m_multires_version == msc.m_canc_list.size(),
          "Cannot cancel pair !! Ms complex resolution is not coarsest.");
-  ENSURE(index(p) == index(q)+1,
+  ENSURE(msc.index(p) == msc.index(q)+1,
          "indices do not differ by 1");
-  ENSURE(m_cp_pair_idx[p] == -1 && m_cp_pair_idx[q] == -1,
+  ENSURE(msc.m_cp_pair_idx[p] == -1 && msc.m_cp_pair_idx[q] == -1,
          "p/q has already been paired");
-  ENSURE(m_des_conn[p].count(q)  == m_asc_conn[q].count(p),
+  ENSURE(msc.m_des_conn[p].count(q)  == msc.m_asc_conn[q].count(p),
          "p is not connected to q");
-  ENSURE(m_des_conn[p].count(q) == 1,
+  ENSURE(msc.m_des_conn[p].count(q) == 1,
          "p and q are multiply connected");
 
-  m_cp_cancno[p] = m_canc_list.size();
-  m_cp_cancno[q] = m_canc_list.size();
-  m_canc_list.push_back(make_pair(p,q));
-
-  cancel_pair();
+  msc.m_cp_cancno[p] = msc.m_canc_list.size();
+  msc.m_cp_cancno[q] = msc.m_canc_list.size();
+  msc.m_canc_list.push_back(make_pair(p,q));
 }
 
-/*---------------------------------------------------------------------------*/
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
 
-void mscomplex_t::cancel_pair()
+/// \brief Pair p and q and reroute the connectivity around them
+/// \note  Only the conn lists of p, q and the cps they connect to change.
+inline void cancel_conn(mscomplex_t &msc,int p,int q)
 {
-  try
-  {
-    ENSURE(is_in_range(m_multires_version,0,m_canc_list.size()),
-           "invalid cancellation position");
+  ASSERT(msc.index(p) == msc.index(q)+1);
+  ASSERT(msc.m_cp_pair_idx[p] == -1);
+  ASSERT(msc.m_cp_pair_idx[q] == -1);
+  ASSERT(msc.m_des_conn[p].count(q) == 1);
+  ASSERT(msc.m_asc_conn[q].count(p) == 1);
 
-    int p = m_canc_list[m_multires_version].first;
-    int q = m_canc_list[m_multires_version].second;
+  msc.m_cp_pair_idx[p] = q;
+  msc.m_cp_pair_idx[q] = p;
 
-    m_multires_version++;
+  msc.m_des_conn[p].erase(q);
+  msc.m_asc_conn[q].erase(p);
 
-    ASSERT(index(p) == index(q)+1);
-    ASSERT(m_cp_pair_idx[p] == -1);
-    ASSERT(m_cp_pair_idx[q] == -1);
-    ASSERT(m_des_conn[p].count(q) == 1);
-    ASSERT(m_asc_conn[q].count(p) == 1);
-//    ASSERT(m_des_conn[p][q] == 1);
-//    ASSERT(m_asc_conn[q][p] == 1);
+  // cps in lower of u except l
+  BOOST_FOREACH(int u,msc.m_des_conn[p])
+  BOOST_FOREACH(int v,msc.m_asc_conn[q])
+  {
+    ASSERT(msc.is_paired(u) == false);
+    ASSERT(msc.is_paired(v) == false);
 
-    m_cp_pair_idx[p] = q;
-    m_cp_pair_idx[q] = p;
+    msc.connect_cps(u,v);
+  }
 
-    m_des_conn[p].erase(q);
-    m_asc_conn[q].erase(p);
+  BOOST_FOREACH(int pr,msc.m_des_conn[p]) msc.m_asc_conn[pr].erase(p);
+  BOOST_FOREACH(int pr,msc.m_asc_conn[p]) msc.m_des_conn[pr].erase(p);
+  BOOST_FOREACH(int pr,msc.m_des_conn[q]) msc.m_asc_conn[pr].erase(q);
+  BOOST_FOREACH(int pr,msc.m_asc_conn[q]) msc.m_des_conn[pr].erase(q);
+}
 
-    // cps in lower of u except l
-    BOOST_FOREACH(int u,m_des_conn[p])
-    BOOST_FOREACH(int v,m_asc_conn[q])
-    {
-      ASSERT(is_paired(u) == false);
-      ASSERT(is_paired(v) == false);
+/*---------------------------------------------------------------------------*/
 
-      connect_cps(u,v);
-    }
+void mscomplex_t::cancel_pair ( int p, int q)
+{
+  order_pr_by_cp_index(*this,p,q);
 
-    BOOST_FOREACH(int pr,m_des_conn[p]) m_asc_conn[pr].erase(p);
-    BOOST_FOREACH(int pr,m_asc_conn[p]) m_des_conn[pr].erase(p);
-    BOOST_FOREACH(int pr,m_des_conn[q]) m_asc_conn[pr].erase(q);
-    BOOST_FOREACH(int pr,m_asc_conn[q]) m_des_conn[pr].erase(q);
-  }
-  catch (std::exception &ex)
-  {
-//    ex.push(_FFL);
-    throw;
-  }
+  push_cancellation(*this,p,q);
+
+  m_simp_tresh = -2;
+
+  cancel_pair();
 }
 
 /*---------------------------------------------------------------------------*/
 
-void mscomplex_t::anticancel_pair()
+void mscomplex_t::cancel_pair()
 {
-  m_multires_version--;
-
   ENSURE(is_in_range(m_multires_version,0,m_canc_list.size()),
          "invalid cancellation position");
 
   int p = m_canc_list[m_multires_version].first;
   int q = m_canc_list[m_multires_version].second;
 
-  ASSERT(index(p) == index(q)+1);
-  ASSERT(m_cp_pair_idx[p] == q);
-  ASSERT(m_cp_pair_idx[q] == p);
+  m_multires_version++;
+
+  cancel_conn(*this,p,q);
+}
 
-  BOOST_FOREACH(int pr,m_des_conn[p]) m_asc_conn[pr].insert(p);
-  BOOST_FOREACH(int pr,m_asc_conn[p]) m_des_conn[pr].insert(p);
-  BOOST_FOREACH(int pr,m_des_conn[q]) m_asc_conn[pr].insert(q);
-  BOOST_FOREACH(int pr,m_asc_conn[q]) m_des_conn[pr].insert(q);
+/*---------------------------------------------------------------------------*/
+
+/// \brief Unpair p and q and put back the connectivity around them
+/// \note  p and q need not be the last cancellation, so long as no later
+///        one touches p, q or the cps they are connected to.
+inline void uncancel_conn(mscomplex_t &msc,int p,int q)
+{
+  ASSERT(msc.index(p) == msc.index(q)+1);
+  ASSERT(msc.m_cp_pair_idx[p] == q);
+  ASSERT(msc.m_cp_pair_idx[q] == p);
+
+  BOOST_FOREACH(int pr,msc.m_des_conn[p]) msc.m_asc_conn[pr].insert(p);
+  BOOST_FOREACH(int pr,msc.m_asc_conn[p]) msc.m_des_conn[pr].insert(p);
+  BOOST_FOREACH(int pr,msc.m_des_conn[q]) msc.m_asc_conn[pr].insert(q);
+  BOOST_FOREACH(int pr,msc.m_asc_conn[q]) msc.m_des_conn[pr].insert(q);
 
   // cps in lower of u except l
-  BOOST_FOREACH(int u,m_des_conn[p])
-      BOOST_FOREACH(int v,m_asc_conn[q])
+  BOOST_FOREACH(int u,msc.m_des_conn[p])
+      BOOST_FOREACH(int v,msc.m_asc_conn[q])
   {
-    disconnect_cps(u,v);
+    msc.disconnect_cps(u,v);
   }
 
-  //    ASSERT(m_des_conn[p][q] == 1);
-  //    ASSERT(m_asc_conn[q][p] == 1);
+  msc.m_cp_pair_idx[p] = -1;
+  msc.m_cp_pair_idx[q] = -1;
+
+  msc.connect_cps(p,q);
+
+  ASSERT(msc.m_des_conn[p].count(q) == 1);
+  ASSERT(msc.m_asc_conn[q].count(p) == 1);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_t::anticancel_pair()
+{
+  m_multires_version--;
 
-  m_cp_pair_idx[p] = -1;
-  m_cp_pair_idx[q] = -1;
+  ENSURE(is_in_range(m_multires_version,0,m_canc_list.size()),
+         "invalid cancellation position");
 
-  connect_cps(p,q);
+  int p = m_canc_list[m_multires_version].first;
+  int q = m_canc_list[m_multires_version].second;
 
-  ASSERT(m_des_conn[p].count(q) == 1);
-  ASSERT(m_asc_conn[q].count(p) == 1);
+  uncancel_conn(*this,p,q);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -498,6 +606,55 @@ inline bool is_within_treshold(const mscomplex_t & msc,int_pair_t e,fn_t t)
 
 /* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
 
+inline bool is_any_marked(const conn_t &conn,const int_list_t &mark,int m)
+{
+  BOOST_FOREACH(int i,conn) if(mark[i] == m) return true;
+  return false;
+}
+
+inline void mark_all(const conn_t &conn,int_list_t &mark,int m)
+{BOOST_FOREACH(int i,conn) mark[i] = m;}
+
+/// \brief Are p, q or any cp connected to them marked with m
+inline bool is_canc_nbd_marked
+(const mscomplex_t &msc,int p,int q,const int_list_t &mark,int m)
+{
+  return mark[p] == m || mark[q] == m ||
+      is_any_marked(msc.m_des_conn[p],mark,m) ||
+      is_any_marked(msc.m_asc_conn[p],mark,m) ||
+      is_any_marked(msc.m_des_conn[q],mark,m) ||
+      is_any_marked(msc.m_asc_conn[q],mark,m);
+}
+
+/// \brief Is p, q or any cp connected to them marked above m
+inline bool is_canc_nbd_after
+(const mscomplex_t &msc,int p,int q,const int_list_t &mark,int m)
+{
+  if(mark[p] > m || mark[q] > m)
+    return true;
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+  {
+    BOOST_FOREACH(int i,msc.m_conn[dir][p]) if(mark[i] > m) return true;
+    BOOST_FOREACH(int i,msc.m_conn[dir][q]) if(mark[i] > m) return true;
+  }
+
+  return false;
+}
+
+/// \brief Mark p, q and every cp connected to them with m
+inline void mark_canc_nbd
+(const mscomplex_t &msc,int p,int q,int_list_t &mark,int m)
+{
+  mark[p] = m; mark[q] = m;
+  mark_all(msc.m_des_conn[p],mark,m);
+  mark_all(msc.m_asc_conn[p],mark,m);
+  mark_all(msc.m_des_conn[q],mark,m);
+  mark_all(msc.m_asc_conn[q],mark,m);
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
 void mscomplex_t::simplify(double f_tresh, bool is_nrm, int req_nmin, int req_nmax)
 {
   BOOST_AUTO(cmp,bind(persistence_lt,boost::cref(*this),_2,_1));
@@ -510,6 +667,8 @@ void mscomplex_t::simplify(double f_tresh, bool is_nrm, int req_nmin, int req_nm
 
   ENSURE(f_tresh >=0 && f_tresh <= f_rng,"tresh out of range");
 
+  int ncanc = m_canc_list.size();
+
   for(int i = 0 ;i < get_num_critpts();++i)
   {
     BOOST_FOREACH(int j,m_des_conn[i])
@@ -529,138 +688,558 @@ void mscomplex_t::simplify(double f_tresh, bool is_nrm, int req_nmin, int req_nm
       (cp_range()|badpt::filtered(bind(&mscomplex_t::is_not_paired,this,_1))
        |badpt::filtered(bind(&mscomplex_t::is_maxima,this,_1)));
 
-  while (pq.size() !=0 && req_nmin <= nmin && req_nmax <= nmax )
+  // Pairs are cancelled in batches taken off the top of pq, in order. A
+  // pair joins the batch if the cps around it (p, q and the cps they are
+  // connected to) are disjoint from those around the pairs already in it,
+  // and if it comes before every pair that the batch's cancellations may
+  // create. So cancelling one pair at a time would cancel exactly the
+  // batch next, in the same order, and as the cancellations touch disjoint
+  // conn lists they are applied concurrently. m_canc_list comes out the
+  // same as that of the one pair at a time loop.
+
+  int_list_t                   mark(get_num_critpts(),-1);
+  int_pair_list_t              batch;
+  std::vector<int_pair_list_t> batch_new;
+
+  for(int round = 0 ; pq.size() !=0 && req_nmin <= nmin && req_nmax <= nmax; ++round)
   {
-    int_pair_t pr = pq.top();
+    batch.clear();
 
-    pq.pop();
+    bool       has_bound = false;
+    int_pair_t bound;
 
-    if(is_valid_canc_edge(*this,pr) == false)
-      continue;
+    while (pq.size() !=0 && req_nmin <= nmin && req_nmax <= nmax )
+    {
+      int_pair_t pr = pq.top();
 
-    int p = pr.first,q = pr.second;
+      if(is_valid_canc_edge(*this,pr) == false)
+      {
+        pq.pop();
+        continue;
+      }
+
+      if(has_bound && !persistence_lt(*this,pr,bound))
+        break;
+
+      int p = pr.first,q = pr.second;
 
-    order_pr_by_cp_index(*this,p,q);
+      order_pr_by_cp_index(*this,p,q);
 
-    cancel_pair(p,q);
+      if(is_canc_nbd_marked(*this,p,q,mark,round))
+        break;
 
-    BOOST_FOREACH(int i,m_des_conn[p])
-    BOOST_FOREACH(int j,m_asc_conn[q])
+      pq.pop();
+
+      mark_canc_nbd(*this,p,q,mark,round);
+      batch.push_back(int_pair_t(p,q));
+
+      // pairs that this cancellation may create
+      BOOST_FOREACH(int i,m_des_conn[p])
+      BOOST_FOREACH(int j,m_asc_conn[q])
+      {
+        int_pair_t npr(i,j);
+
+        if(i != q && j != p && is_boundry(i) == is_boundry(j) &&
+           is_within_treshold(*this,npr,f_tresh) &&
+           (!has_bound || persistence_lt(*this,npr,bound)))
+        {
+          bound     = npr;
+          has_bound = true;
+        }
+      }
+
+      if(index(p) == 2) --nmax; else --nmin;
+    }
+
+    int nb = batch.size();
+
+    for(int k = 0 ; k < nb; ++k)
     {
-      int_pair_t npr(i,j);
+      push_cancellation(*this,batch[k].first,batch[k].second);
+      m_multires_version++;
+    }
 
-      if(is_valid_canc_edge(*this,npr) && is_within_treshold(*this,npr,f_tresh))
-        pq.push(npr);
+    batch_new.resize(std::max<int>(nb,batch_new.size()));
+
+#pragma omp parallel for schedule(dynamic,1) if(nb > 1)
+    for(int k = 0 ; k < nb; ++k)
+    {
+      int p = batch[k].first,q = batch[k].second;
+
+      cancel_conn(*this,p,q);
+
+      batch_new[k].clear();
+
+      BOOST_FOREACH(int i,m_des_conn[p])
+      BOOST_FOREACH(int j,m_asc_conn[q])
+      {
+        int_pair_t npr(i,j);
+
+        if(is_valid_canc_edge(*this,npr) && is_within_treshold(*this,npr,f_tresh))
+          batch_new[k].push_back(npr);
+      }
     }
 
-    if(index(p) == 2) --nmax; else --nmin;
+    for(int k = 0 ; k < nb; ++k)
+      BOOST_FOREACH(int_pair_t npr,batch_new[k])
+        pq.push(npr);
   }
+
+  // A stop on the cp counts, or cancellations of unknown threshold, cannot
+  // be redone by mscomplex_edit_t
+  if(pq.size() != 0 || m_simp_tresh < -1 || (m_simp_tresh < 0 && ncanc != 0))
+    m_simp_tresh = -2;
+  else
+    m_simp_tresh = std::max(m_simp_tresh,f_tresh);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void mscomplex_t::set_multires_version(int version)
+inline void mscomplex_edit_t::add(int c)
 {
-  for(int i = m_multires_version ; i > version && i>0; i--)
-  {
-    anticancel_pair();
-  }
-
-  for( int i = m_multires_version; i <version&&i<m_canc_list.size(); ++i)
+  if(m_mark[c] != 0)
   {
-    cancel_pair();
+    m_mark[c] = 0;
+    m_rgn.push_back(c);
   }
 }
 
-/*---------------------------------------------------------------------------*/
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
 
-bool is_t_lt_abs_diff(const mscomplex_t * msc, double t,int i)
+mscomplex_edit_t::mscomplex_edit_t(mscomplex_t &msc,const int_list_t &cps)
+  :m_msc(msc)
 {
-  ASSERT(is_in_range(i,0,msc->m_canc_list.size()+1));
+  ENSURE(msc.m_canc_list.size() == 0 || msc.m_simp_tresh >= 0,
+         "the simplification of msc cannot be redone locally");
 
-  if( i == msc->m_canc_list.size())
-    return false;
-  else
-    return t < std::abs
-        (msc->fn(msc->m_canc_list[i].first) -
-         msc->fn(msc->m_canc_list[i].second));
+  msc.set_multires_version(msc.m_canc_list.size());
+
+  m_mark.assign(msc.get_num_critpts(),-1);
+  m_kept.assign(boost::counting_iterator<int>(0),
+                boost::counting_iterator<int>(msc.m_canc_list.size()));
+
+  BOOST_FOREACH(int c,cps) add(c);
+
+  undo_touching();
 }
 
 /* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
 
-int mscomplex_t::get_multires_version_for_thresh(double t, bool is_nrm) const
+void mscomplex_edit_t::undo_touching()
 {
-  if(is_nrm)
-    t *= (m_fmax - m_fmin);
+  int_list_t kept,undone;
 
-  return *std::upper_bound
-      (boost::counting_iterator<int>(0),
-       boost::counting_iterator<int>(m_canc_list.size()+1),
-       t,bind(is_t_lt_abs_diff,this,_1,_2));
-}
+  // in order, so that the cps touched by an undone one are marked before
+  // the later ones are looked at
+  BOOST_FOREACH(int k,m_kept)
+  {
+    int p = m_msc.m_canc_list[k].first,q = m_msc.m_canc_list[k].second;
 
-/*---------------------------------------------------------------------------*/
+    if(!is_canc_nbd_marked(m_msc,p,q,m_mark,0))
+    {
+      kept.push_back(k);
+      continue;
+    }
 
-typedef std::map<int,int_list_t> contrib_t;
+    undone.push_back(k);
 
-template<eGDIR dir,int dim>
-void get_contrib_cps(mscomplex_ptr_t msc,contrib_t& contrib)
+    add(p); add(q);
+
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    {
+      BOOST_FOREACH(int d,m_msc.m_conn[dir][p]) add(d);
+      BOOST_FOREACH(int d,m_msc.m_conn[dir][q]) add(d);
+    }
+  }
+
+  m_kept.swap(kept);
+
+  // no kept one after an undone one touches it, so they commute
+  for(int i = undone.size()-1 ; i >= 0; --i)
+    uncancel_conn(m_msc,m_msc.m_canc_list[undone[i]].first,
+                  m_msc.m_canc_list[undone[i]].second);
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+void mscomplex_edit_t::simplify_rgn(int_pair_list_t &cancs)
 {
-  const eGDIR odir = (dir == ASC)?(DES):(ASC);
-  const int   odim = (dir == ASC)?(dim +1):(dim -1);
+  mscomplex_t &msc = m_msc;
+  fn_t         t   = msc.m_simp_tresh;
 
-  contrib_t contrib_map;
+  BOOST_AUTO(cmp,bind(persistence_lt,boost::cref(msc),_2,_1));
 
-  // first, obtain a sequence of cancellations so that
-  // a) each pair is ordered by dir ..
-  //    i.e if dir is DES then look at a (2,1) as (2,1) and not (1,2)
-  // b) pairs that have not yet been cancelled are removed
-  // c) pairs whose first element have index == dim
+  priority_queue<int_pair_t,int_pair_list_t,BOOST_TYPEOF(cmp)> pq(cmp);
 
-  BOOST_AUTO(canc_rng,msc->m_canc_list
-             |badpt::sliced(0,msc->m_multires_version)
-             |badpt::transformed(bind(order_by_dir_index<dir>,msc,_1))
-             |badpt::filtered(bind(is_dim_pair<dim,odim>,msc,_1))
-             );
+  BOOST_FOREACH(int i,m_rgn)
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+      BOOST_FOREACH(int j,msc.m_conn[dir][i])
+      {
+        int_pair_t pr(i,j);
 
-  // This part computes for each cancelled critical point,
-  // the surviving critical points to which it contributes its
-  // finest resolution geometry .
-  BOOST_FOREACH(int_pair_t pr,canc_rng|badpt::reversed)
+        if(is_valid_canc_edge(msc,pr) && is_within_treshold(msc,pr,t))
+          pq.push(pr);
+      }
+
+  // one at a time, as there are few
+  while(pq.size() != 0)
   {
+    int_pair_t pr = pq.top();
+
+    pq.pop();
+
+    if(is_valid_canc_edge(msc,pr) == false)
+      continue;
+
     int p = pr.first,q = pr.second;
 
-    int_list_t & pcontrib = contrib_map[p];
+    order_pr_by_cp_index(msc,p,q);
 
-    // for each qa in the asc conn of q:
-    BOOST_FOREACH(int qa, msc->m_conn[odir][q])
+    cancel_conn(msc,p,q);
+    cancs.push_back(int_pair_t(p,q));
+
+    BOOST_FOREACH(int i,msc.m_des_conn[p])
+    BOOST_FOREACH(int j,msc.m_asc_conn[q])
     {
-      // a) if qa is not paired ..
-      if(msc->is_not_paired(qa))
-      {
-        // .. p contributes to qa.
-        pcontrib.push_back(qa);
-      }
-      // b) if qa is paired and qa's pair and q have same index ..
-      else if(msc->index(q) == msc->index(msc->pair_idx(qa)))
-      {
-        // .. then foreach qaqa that qa contributes to  ..
-        BOOST_FOREACH(int qaqa,contrib_map[qa])
-        {
-          // .. p contributes to qaqa.
-          pcontrib.push_back(qaqa);
+      int_pair_t npr(i,j);
 
-          // pdpd has to be a surviving cp
-          ASSERT(msc->is_not_paired(qaqa));
-        }
-      }
+      if(is_valid_canc_edge(msc,npr) && is_within_treshold(msc,npr,t))
+        pq.push(npr);
     }
   }
+}
 
-  // This part just reverses info computed earlier.
-  // i.e each surviving critical point will have a
-  // list of cancelled critical points that contribute
-  // their finest res geometry to it.
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+void mscomplex_edit_t::commit()
+{
+  mscomplex_t &msc = m_msc;
+
+  int n = msc.get_num_critpts(), on = m_mark.size();
+
+  m_mark.resize(n,-1);
+
+  for(int i = on ; i < n; ++i)
+    add(i);
+
+  int_pair_list_t cancs,canc_list;
+  bool_list_t     is_new;
+  int_list_t      last,nbd;
+
+  while(true)
+  {
+    cancs.clear();
+
+    if(msc.m_simp_tresh >= 0)
+      simplify_rgn(cancs);
+
+    // merge the kept and the new ones by persistence
+    int nk = m_kept.size(), nc = cancs.size();
+
+    canc_list.clear();
+    is_new.clear();
+
+    for(int i = 0,j = 0 ; i < nk || j < nc;)
+    {
+      int_pair_t pr = (i < nk)?(msc.m_canc_list[m_kept[i]]):(int_pair_t(-1,-1));
+
+      if(i == nk || (j < nc && persistence_lt(msc,cancs[j],pr)))
+      {
+        canc_list.push_back(cancs[j++]);
+        is_new.push_back(true);
+      }
+      else
+      {
+        canc_list.push_back(pr); ++i;
+        is_new.push_back(false);
+      }
+    }
+
+    // the last kept cancellation that touches each cp
+    last.assign(n,-1);
+
+    for(int i = 0 ; i < canc_list.size(); ++i)
+      if(!is_new[i])
+        mark_canc_nbd(msc,canc_list[i].first,canc_list[i].second,last,i);
+
+    // new ones that land before a kept one that they touch
+    nbd.clear();
+
+    for(int i = 0 ; i < canc_list.size(); ++i)
+    {
+      int p = canc_list[i].first,q = canc_list[i].second;
+
+      if(is_new[i] && is_canc_nbd_after(msc,p,q,last,i))
+      {
+        nbd.push_back(p); nbd.push_back(q);
+
+        for(int dir = 0 ; dir < GDIR_CT; ++dir)
+        {
+          nbd.insert(nbd.end(),msc.m_conn[dir][p].begin(),msc.m_conn[dir][p].end());
+          nbd.insert(nbd.end(),msc.m_conn[dir][q].begin(),msc.m_conn[dir][q].end());
+        }
+      }
+    }
+
+    if(nbd.size() == 0)
+      break;
+
+    for(int i = nc-1 ; i >= 0; --i)
+      uncancel_conn(msc,cancs[i].first,cancs[i].second);
+
+    BOOST_FOREACH(int c,nbd) add(c);
+
+    undo_touching();
+  }
+
+  msc.m_canc_list.swap(canc_list);
+  msc.m_canc_pers.clear();
+  msc.m_multires_version = msc.m_canc_list.size();
+
+  for(int i = 0 ; i < msc.m_canc_list.size(); ++i)
+  {
+    msc.m_cp_cancno[msc.m_canc_list[i].first]  = i;
+    msc.m_cp_cancno[msc.m_canc_list[i].second] = i;
+  }
+
+  msc.m_checkpoints.clear();
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    for(int i = 0 ; i < n; ++i)
+      mfold_t().swap(msc.m_mfolds[dir][i]);
+
+  // cps left paired to themselves are dead (see dataset_t::update)
+  msc.m_fmax = std::numeric_limits<fn_t>::min();
+  msc.m_fmin = std::numeric_limits<fn_t>::max();
+
+  for(int i = 0 ; i < n; ++i)
+    if(msc.m_cp_pair_idx[i] != i)
+    {
+      msc.m_fmax = std::max(msc.m_fmax,msc.fn(i));
+      msc.m_fmin = std::min(msc.m_fmin,msc.fn(i));
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+size_t multires_checkpoint_t::bytes() const
+{
+  size_t b = pair_idx.size()*sizeof(int);
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    b += conn_offs[dir].size()*sizeof(uint64_t) +
+        conn[dir].size()*sizeof(conn_t::entry_t);
+
+  return b;
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+inline void take_checkpoint(const mscomplex_t &msc,multires_checkpoint_t &c)
+{
+  int n = msc.get_num_critpts();
+
+  c.version  = msc.m_multires_version;
+  c.pair_idx = msc.m_cp_pair_idx;
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+  {
+    c.conn_offs[dir].assign(n+1,0);
+
+    for(int i = 0 ; i < n; ++i)
+      c.conn_offs[dir][i+1] = c.conn_offs[dir][i] + msc.m_conn[dir][i].num_entries();
+
+    c.conn[dir].resize(c.conn_offs[dir][n]);
+
+#pragma omp parallel for schedule(dynamic,1024)
+    for(int i = 0 ; i < n; ++i)
+      std::copy(msc.m_conn[dir][i].entries(),
+                msc.m_conn[dir][i].entries() + msc.m_conn[dir][i].num_entries(),
+                c.conn[dir].begin() + c.conn_offs[dir][i]);
+  }
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+inline void restore_checkpoint(mscomplex_t &msc,const multires_checkpoint_t &c)
+{
+  int n = msc.get_num_critpts();
+
+  ASSERT(c.pair_idx.size() == n);
+
+  msc.m_multires_version = c.version;
+  msc.m_cp_pair_idx      = c.pair_idx;
+
+#pragma omp parallel for schedule(dynamic,1024)
+  for(int i = 0 ; i < n; ++i)
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+      msc.m_conn[dir][i].assign(c.conn[dir].data() + c.conn_offs[dir][i],
+                                c.conn[dir].data() + c.conn_offs[dir][i+1]);
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+inline bool checkpoint_version_lt(int v,const multires_checkpoint_t &c)
+{return v < c.version;}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+void mscomplex_t::set_multires_version(int version)
+{
+  version = std::max(0,std::min<int>(version,m_canc_list.size()));
+
+  // the last checkpoint at or below version
+  BOOST_AUTO(it,std::upper_bound(m_checkpoints.begin(),m_checkpoints.end(),
+                                 version,checkpoint_version_lt));
+
+  if(it != m_checkpoints.begin() &&
+     version - (it-1)->version < std::abs(version - m_multires_version))
+    restore_checkpoint(*this,*(it-1));
+
+  for(int i = m_multires_version ; i > version && i>0; i--)
+  {
+    anticancel_pair();
+  }
+
+  for( int i = m_multires_version; i <version&&i<m_canc_list.size(); ++i)
+  {
+    cancel_pair();
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_t::make_multires_checkpoints(size_t max_bytes)
+{
+  int v = m_multires_version, N = m_canc_list.size();
+
+  set_multires_version(0);
+
+  m_checkpoints.clear();
+  m_checkpoints.push_back(multires_checkpoint_t());
+  take_checkpoint(*this,m_checkpoints.back());
+
+  size_t b = m_checkpoints.back().bytes(), used = b;
+
+  if(used > max_bytes)
+  {
+    m_checkpoints.clear();
+    set_multires_version(v);
+    return;
+  }
+
+  // as many as the budget holds if they were all as big as the first
+  int num   = std::max<size_t>(1,max_bytes/std::max<size_t>(b,1));
+  int intvl = std::max(1,(N + num)/num);
+
+  for(int i = intvl ; i <= N; i += intvl)
+  {
+    set_multires_version(i);
+
+    m_checkpoints.push_back(multires_checkpoint_t());
+    take_checkpoint(*this,m_checkpoints.back());
+
+    used += m_checkpoints.back().bytes();
+
+    if(used > max_bytes)
+    {
+      m_checkpoints.pop_back();
+      break;
+    }
+  }
+
+  set_multires_version(v);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool is_t_lt_abs_diff(const mscomplex_t * msc, double t,int i)
+{
+  ASSERT(is_in_range(i,0,msc->m_canc_list.size()+1));
+
+  if( i == msc->m_canc_list.size())
+    return false;
+  else
+    return t < std::abs
+        (msc->fn(msc->m_canc_list[i].first) -
+         msc->fn(msc->m_canc_list[i].second));
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+int mscomplex_t::get_multires_version_for_thresh(double t, bool is_nrm) const
+{
+  if(is_nrm)
+    t *= (m_fmax - m_fmin);
+
+  return *std::upper_bound
+      (boost::counting_iterator<int>(0),
+       boost::counting_iterator<int>(m_canc_list.size()+1),
+       t,bind(is_t_lt_abs_diff,this,_1,_2));
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef std::map<int,int_list_t> contrib_t;
+
+template<eGDIR dir,int dim>
+void get_contrib_cps(mscomplex_ptr_t msc,contrib_t& contrib)
+{
+  const eGDIR odir = (dir == ASC)?(DES):(ASC);
+  const int   odim = (dir == ASC)?(dim +1):(dim -1);
+
+  contrib_t contrib_map;
+
+  // first, obtain a sequence of cancellations so that
+  // a) each pair is ordered by dir ..
+  //    i.e if dir is DES then look at a (2,1) as (2,1) and not (1,2)
+  // b) pairs that have not yet been cancelled are removed
+  // c) pairs whose first element have index == dim
+
+  BOOST_AUTO(canc_rng,msc->m_canc_list
+             |badpt::sliced(0,msc->m_multires_version)
+             |badpt::transformed(bind(order_by_dir_index<dir>,msc,_1))
+             |badpt::filtered(bind(is_dim_pair<dim,odim>,msc,_1))
+             );
+
+  // This part computes for each cancelled critical point,
+  // the surviving critical points to which it contributes its
+  // finest resolution geometry .
+  BOOST_FOREACH(int_pair_t pr,canc_rng|badpt::reversed)
+  {
+    int p = pr.first,q = pr.second;
+
+    int_list_t & pcontrib = contrib_map[p];
+
+    // for each qa in the asc conn of q:
+    BOOST_FOREACH(int qa, msc->m_conn[odir][q])
+    {
+      // a) if qa is not paired ..
+      if(msc->is_not_paired(qa))
+      {
+        // .. p contributes to qa.
+        pcontrib.push_back(qa);
+      }
+      // b) if qa is paired and qa's pair and q have same index ..
+      else if(msc->index(q) == msc->index(msc->pair_idx(qa)))
+      {
+        // .. then foreach qaqa that qa contributes to  ..
+        BOOST_FOREACH(int qaqa,contrib_map[qa])
+        {
+          // .. p contributes to qaqa.
+          pcontrib.push_back(qaqa);
+
+          // pdpd has to be a surviving cp
+          ASSERT(msc->is_not_paired(qaqa));
+        }
+      }
+    }
+  }
+
+  // This part just reverses info computed earlier.
+  // i.e each surviving critical point will have a
+  // list of cancelled critical points that contribute
+  // their finest res geometry to it.
 
   BOOST_FOREACH(int_pair_t pr, canc_rng)
   {
@@ -702,23 +1281,56 @@ void get_contrib_cps(mscomplex_ptr_t msc,contrib_t& contrib)
 
 /* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
 
-template <eGDIR dir, int dim>
-inline void __collect_mfolds(mscomplex_ptr_t msc, dataset_ptr_t ds)
+typedef std::pair<eGDIR,contrib_t::const_iterator> mfold_task_t;
+typedef std::vector<mfold_task_t>                  mfold_task_list_t;
+
+template <eGDIR dir>
+inline void add_mfold_tasks(const contrib_t &contrib, mfold_task_list_t &tasks)
 {
-  contrib_t contrib;
-  get_contrib_cps<dir,dim>(msc,contrib);
+  for(contrib_t::const_iterator it = contrib.begin(); it != contrib.end(); ++it)
+    tasks.push_back(mfold_task_t(dir,it));
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
 
-  BOOST_FOREACH(contrib_t::value_type pr,contrib)
+/// \brief Collect the geometry of each task's cp.
+/// \note  Each task writes only its own m_mfolds[dir][cp] and the traversals
+///        just read the gradient. So they are simply split over threads.
+inline void __collect_mfolds
+(mscomplex_ptr_t msc, dataset_ptr_t ds,const mfold_task_list_t & tasks)
+{
+  int n = tasks.size();
+
+#pragma omp parallel for schedule(dynamic,1)
+  for(int i = 0 ; i < n; ++i)
   {
-//    ENSURE(msc->m_mfolds[dir][pr.first].size() == 0,
-//        "Geom for cp has already been collected");
+    eGDIR dir = tasks[i].first;
+    int   cp  = tasks[i].second->first;
 
-    msc->m_mfolds[dir][pr.first].clear();
+    BOOST_AUTO(rng,tasks[i].second->second
+               |badpt::transformed(bind(&mscomplex_t::cellid,msc,_1)));
 
-    ds->get_mfold<dir>(msc->m_mfolds[dir][pr.first],
-        pr.second|badpt::transformed(bind(&mscomplex_t::cellid,msc,_1)));
+    msc->m_mfolds[dir][cp].clear();
 
+    if(dir == DES)
+      ds->get_mfold<DES>(msc->m_mfolds[dir][cp],rng);
+    else
+      ds->get_mfold<ASC>(msc->m_mfolds[dir][cp],rng);
   }
+}
+
+/* -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  - */
+
+template <eGDIR dir, int dim>
+inline void __collect_mfolds(mscomplex_ptr_t msc, dataset_ptr_t ds)
+{
+  contrib_t contrib;
+  get_contrib_cps<dir,dim>(msc,contrib);
+
+  mfold_task_list_t tasks;
+  add_mfold_tasks<dir>(contrib,tasks);
+
+  __collect_mfolds(msc,ds,tasks);
 
 //  msc->m_merge_dag->build<dir,dim>(msc);
 }
@@ -736,13 +1348,201 @@ void mscomplex_t::collect_mfolds(eGDIR dir, int dim, dataset_ptr_t ds)
 
 void mscomplex_t::collect_mfolds(dataset_ptr_t ds)
 {
-  __collect_mfolds<ASC,0>(shared_from_this(),ds);
-  __collect_mfolds<ASC,1>(shared_from_this(),ds);
-  __collect_mfolds<DES,1>(shared_from_this(),ds);
-  __collect_mfolds<DES,2>(shared_from_this(),ds);
+  mscomplex_ptr_t msc = shared_from_this();
+
+  // The four (dir,dim) passes only read the complex. So the contributions
+  // are found concurrently and then all traversals go into one task list.
+  contrib_t contrib[4];
+
+#pragma omp parallel sections
+  {
+#pragma omp section
+    get_contrib_cps<ASC,0>(msc,contrib[0]);
+#pragma omp section
+    get_contrib_cps<ASC,1>(msc,contrib[1]);
+#pragma omp section
+    get_contrib_cps<DES,1>(msc,contrib[2]);
+#pragma omp section
+    get_contrib_cps<DES,2>(msc,contrib[3]);
+  }
+
+  mfold_task_list_t tasks;
+
+  add_mfold_tasks<ASC>(contrib[0],tasks);
+  add_mfold_tasks<ASC>(contrib[1],tasks);
+  add_mfold_tasks<DES>(contrib[2],tasks);
+  add_mfold_tasks<DES>(contrib[3],tasks);
+
+  __collect_mfolds(msc,ds,tasks);
 }
 
 
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_t::get_mfold_labels
+(eGDIR dir,int dim,dataset_ptr_t ds,int_list_t &labels)
+{
+  mscomplex_ptr_t msc = shared_from_this();
+
+  contrib_t contrib;
+
+  if(dir == ASC && dim == 0 ) get_contrib_cps<ASC,0>(msc,contrib);
+  else if(dir == ASC && dim == 1 ) get_contrib_cps<ASC,1>(msc,contrib);
+  else if(dir == DES && dim == 1 ) get_contrib_cps<DES,1>(msc,contrib);
+  else if(dir == DES && dim == 2 ) get_contrib_cps<DES,2>(msc,contrib);
+  else ENSUREV2(false,"no labels for this dir and dim",dir,dim);
+
+  const tri_cc_t &tcc = *ds->m_tcc;
+
+  int N = tcc.get_num_cells_dim(dim), off = tcc.get_num_cells_max_dim(dim) - N;
+
+  labels.assign(N,-1);
+
+  if(dim == 1)
+  {
+    // contrib is ordered by cp, so the first label written is the lowest
+    for(contrib_t::iterator it = contrib.begin(); it != contrib.end(); ++it)
+    {
+      mfold_t mfold;
+
+      BOOST_AUTO(rng,it->second|badpt::transformed(bind(&mscomplex_t::cellid,msc,_1)));
+
+      if(dir == DES)
+        ds->get_mfold<DES>(mfold,rng);
+      else
+        ds->get_mfold<ASC>(mfold,rng);
+
+      BOOST_FOREACH(cellid_t c,mfold)
+        if(labels[c-off] == -1)
+          labels[c-off] = it->first;
+    }
+    return;
+  }
+
+  // the surviving cp of each extremum, at the extremum's cell
+  int_list_t surv(N,-1);
+
+  for(contrib_t::iterator it = contrib.begin(); it != contrib.end(); ++it)
+    BOOST_FOREACH(int p,it->second)
+      surv[cellid(p)-off] = it->first;
+
+#pragma omp parallel for schedule(dynamic,4096)
+  for(int c = 0 ; c < N; ++c)
+  {
+    cellid_t o = ds->m_cell_own[ds->own_idx(c+off)];
+
+    if(o != invalid_cellid)
+      labels[c] = surv[o-off];
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+mfold_cache_t::mfold_cache_t(mscomplex_ptr_t msc,dataset_ptr_t ds,size_t max_cells)
+  :m_msc(msc->shared_from_this()),m_ds(ds),m_max_cells(max_cells)
+{
+  // msc may hold its own count (e.g. one made by boost python for a call)
+  // and go away with the call.. the weak ptr must be of the owning one.
+  clear();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mfold_cache_t::clear()
+{
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    for(int dim = 0 ; dim <= gc_max_cell_dim; ++dim)
+    {
+      m_contrib[dir][dim].clear();
+      m_has_contrib[dir][dim] = false;
+    }
+
+  m_lru.clear();
+  m_index.clear();
+  m_num_cells = 0;
+  m_version   = -1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+const mfold_cache_t::contrib_t & mfold_cache_t::get_contrib(eGDIR dir,int dim)
+{
+  if(!m_has_contrib[dir][dim])
+  {
+    mscomplex_ptr_t msc(m_msc);
+    contrib_t &c = m_contrib[dir][dim];
+
+    if(dir == ASC && dim == 0 ) get_contrib_cps<ASC,0>(msc,c);
+    if(dir == ASC && dim == 1 ) get_contrib_cps<ASC,1>(msc,c);
+    if(dir == DES && dim == 1 ) get_contrib_cps<DES,1>(msc,c);
+    if(dir == DES && dim == 2 ) get_contrib_cps<DES,2>(msc,c);
+
+    m_has_contrib[dir][dim] = true;
+  }
+
+  return m_contrib[dir][dim];
+}
+
+/*---------------------------------------------------------------------------*/
+
+const mfold_t & mfold_cache_t::get(eGDIR dir,int cp)
+{
+  mscomplex_ptr_t msc(m_msc);
+
+  ASSERT(is_in_range(cp,0,msc->get_num_critpts()));
+
+  if(m_version != msc->m_multires_version)
+  {
+    clear();
+    m_version = msc->m_multires_version;
+  }
+
+  int key = GDIR_CT*cp + dir;
+
+  std::map<int,lru_t::iterator>::iterator it = m_index.find(key);
+
+  if(it != m_index.end())
+  {
+    m_lru.splice(m_lru.begin(),m_lru,it->second);
+    return it->second->second;
+  }
+
+  m_lru.push_front(std::make_pair(key,mfold_t()));
+  m_index[key] = m_lru.begin();
+
+  mfold_t &mfold = m_lru.front().second;
+  int      dim   = msc->index(cp);
+
+  // des manifolds of minima and asc manifolds of maxima are not collected
+  if((dir == DES && dim != 0) || (dir == ASC && dim != gc_max_cell_dim))
+  {
+    const contrib_t &contrib = get_contrib(dir,dim);
+    contrib_t::const_iterator ci = contrib.find(cp);
+
+    if(ci != contrib.end())
+    {
+      BOOST_AUTO(rng,ci->second|badpt::transformed(bind(&mscomplex_t::cellid,msc,_1)));
+
+      if(dir == DES)
+        m_ds->get_mfold<DES>(mfold,rng);
+      else
+        m_ds->get_mfold<ASC>(mfold,rng);
+    }
+  }
+
+  m_num_cells += mfold.size();
+
+  // the one just asked for is kept even if it alone is over the limit
+  while(m_num_cells > m_max_cells && m_lru.size() > 1)
+  {
+    m_num_cells -= m_lru.back().second.size();
+    m_index.erase(m_lru.back().first);
+    m_lru.pop_back();
+  }
+
+  return mfold;
+}
+
 /*---------------------------------------------------------------------------*/
 
 void mscomplex_t::get_mfold(eGDIR dir, int cp,cellid_list_t &mfold,int ver)
@@ -772,8 +1572,35 @@ void mscomplex_t::serialize(Archive & ar, const unsigned int version)
   ar& BOOST_SERIALIZATION_NVP(m_cp_is_boundry);
   ar& BOOST_SERIALIZATION_NVP(m_cp_fn);
   ar& BOOST_SERIALIZATION_NVP(m_canc_list);
-  ar& BOOST_SERIALIZATION_NVP(m_des_conn);
-  ar& BOOST_SERIALIZATION_NVP(m_asc_conn);
+  // connectivity is archived as multisets, as it used to be stored.
+  std::vector<std::multiset<uint> > conn[GDIR_CT];
+
+  if(Archive::is_saving::value)
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    {
+      conn[dir].resize(m_conn[dir].size());
+
+      for(int i = 0 ; i < m_conn[dir].size(); ++i)
+        conn[dir][i].insert(m_conn[dir][i].begin(),m_conn[dir][i].end());
+    }
+
+  ar& boost::serialization::make_nvp("m_des_conn",conn[DES]);
+  ar& boost::serialization::make_nvp("m_asc_conn",conn[ASC]);
+
+  if(Archive::is_loading::value)
+    m_checkpoints.clear();
+
+  if(Archive::is_loading::value)
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    {
+      m_conn[dir].clear();
+      m_conn[dir].resize(conn[dir].size());
+
+      for(int i = 0 ; i < conn[dir].size(); ++i)
+        BOOST_FOREACH(uint c,conn[dir][i])
+          m_conn[dir][i].insert(c);
+    }
+
   ar& BOOST_SERIALIZATION_NVP(m_des_mfolds);
   ar& BOOST_SERIALIZATION_NVP(m_asc_mfolds);
   ar& BOOST_SERIALIZATION_NVP(m_multires_version);
@@ -798,8 +1625,440 @@ void mscomplex_t::load_bin(std::istream &is)
   ia >> BOOST_SERIALIZATION_NVP(*this);
 }
 
+/*===========================================================================*/
+
+static const char     msc_file_magic[8] = {'M','S','T','R','I','M','S','C'};
+static const uint32_t msc_file_version  = 1;
+
+struct msc_file_header_t
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t num_sections;
+};
+
+struct msc_file_section_t
+{
+  uint32_t id;
+  uint32_t elem_size;
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct msc_file_info_t
+{
+  uint32_t num_cps;
+  int32_t  multires_version;
+  double   fmin;
+  double   fmax;
+};
+
+BOOST_STATIC_ASSERT(sizeof(merge_dag_t::node_t) == 3*sizeof(int32_t));
+BOOST_STATIC_ASSERT(sizeof(conn_t::entry_t) == 2*sizeof(uint32_t));
+
+/*---------------------------------------------------------------------------*/
+
+/// \brief Writes the sections one after the other and the table at the end
+class msc_file_writer_t
+{
+public:
+  msc_file_writer_t(const std::string &f,int max_sections)
+    :m_fs(f.c_str(),std::ios::out|std::ios::binary),m_max_sections(max_sections)
+  {
+    ENSUREV(m_fs.is_open(),"unable to open file for writing",f);
+
+    std::vector<char> z(sizeof(msc_file_header_t) +
+                        m_max_sections*sizeof(msc_file_section_t),0);
+    m_fs.write(z.data(),z.size());
+  }
+
+  /// \brief Start a section. Its data is then added with write
+  void begin(int id,size_t elem_size)
+  {
+    ASSERT(m_secs.size() < m_max_sections);
+
+    static const char z[8] = {0};
+    m_fs.write(z,(8 - m_fs.tellp()%8)%8);
+
+    msc_file_section_t sec = {uint32_t(id),uint32_t(elem_size),
+                              uint64_t(m_fs.tellp()),0};
+    m_secs.push_back(sec);
+  }
+
+  template<typename T>
+  void write(const T *p,size_t n)
+  {
+    ASSERT(sizeof(T) == m_secs.back().elem_size);
+
+    m_fs.write((const char*)p,n*sizeof(T));
+    m_secs.back().count += n;
+  }
+
+  void close()
+  {
+    msc_file_header_t hdr;
+
+    memcpy(hdr.magic,msc_file_magic,sizeof(hdr.magic));
+    hdr.version      = msc_file_version;
+    hdr.num_sections = m_secs.size();
+
+    m_fs.seekp(0);
+    m_fs.write((const char*)&hdr,sizeof(hdr));
+    m_fs.write((const char*)m_secs.data(),m_secs.size()*sizeof(m_secs[0]));
+
+    ENSURE(m_fs.good(),"failed writing msc file");
+  }
+
+private:
+  std::fstream                    m_fs;
+  std::vector<msc_file_section_t> m_secs;
+  int                             m_max_sections;
+};
+
+/*---------------------------------------------------------------------------*/
+
+template<typename T>
+inline void write_csr(msc_file_writer_t &w,int id_offs,int id,
+                      const std::vector<T> &l,int n)
+{
+  std::vector<uint64_t> offs(n+1,0);
+
+  for(int i = 0 ; i < n; ++i)
+    offs[i+1] = offs[i] + ((i < l.size())?(l[i].size()):(0));
+
+  w.begin(id_offs,sizeof(uint64_t));
+  w.write(offs.data(),offs.size());
+
+  w.begin(id,sizeof(typename T::value_type));
+
+  for(int i = 0 ; i < n && i < l.size(); ++i)
+    w.write(l[i].data(),l[i].size());
+}
+
+/// \brief conn_t is written as its entries and not as the copies it iterates
+struct conn_entries_t
+{
+  typedef conn_t::entry_t value_type;
+
+  const conn_t &c;
+  conn_entries_t(const conn_t &c):c(c){}
+
+  inline size_t size() const {return c.num_entries();}
+  inline const value_type * data() const {return c.entries();}
+};
+
 /*---------------------------------------------------------------------------*/
 
+void encode_mfold(const cellid_t *b,const cellid_t *e,std::vector<uint8_t> &code)
+{
+  uint32_t p = 0;
+
+  for(; b != e; ++b)
+  {
+    // differences wrap around mod 2^32.. decoding wraps them back
+    int32_t  d = uint32_t(*b) - p;
+    uint32_t z = (uint32_t(d) << 1) ^ uint32_t(d >> 31);
+
+    for(; z >= 0x80; z >>= 7)
+      code.push_back(uint8_t(z | 0x80));
+
+    code.push_back(uint8_t(z));
+
+    p = uint32_t(*b);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void decode_mfold(const uint8_t *b,const uint8_t *e,mfold_t &m)
+{
+  uint32_t p = 0;
+
+  while(b != e)
+  {
+    uint32_t z = *b & 0x7f;
+
+    for(int s = 7; *b++ & 0x80; s += 7)
+    {
+      ASSERT(b != e && s < 32);
+      z |= uint32_t(*b & 0x7f) << s;
+    }
+
+    p += (z >> 1) ^ (0u - (z & 1));
+    m.push_back(cellid_t(p));
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_t::save_msc
+(const std::string &f,bool compress_mfolds,dataset_ptr_t ds) const
+{
+  msc_file_writer_t w(f,MSC_SEC_CT);
+
+  int n = get_num_critpts();
+
+  msc_file_info_t info = {uint32_t(n),int32_t(m_multires_version),m_fmin,m_fmax};
+
+  w.begin(MSC_SEC_INFO,sizeof(info));       w.write(&info,1);
+  w.begin(MSC_SEC_CP_CELLID,sizeof(int));   w.write(m_cp_cellid.data(),n);
+  w.begin(MSC_SEC_CP_VERTID,sizeof(int));   w.write(m_cp_vertid.data(),n);
+  w.begin(MSC_SEC_CP_PAIR_IDX,sizeof(int)); w.write(m_cp_pair_idx.data(),n);
+  w.begin(MSC_SEC_CP_CANCNO,sizeof(int));   w.write(m_cp_cancno.data(),n);
+  w.begin(MSC_SEC_CP_INDEX,sizeof(char));   w.write(m_cp_index.data(),n);
+  w.begin(MSC_SEC_CP_BNDRY,sizeof(char));   w.write(m_cp_is_boundry.data(),n);
+  w.begin(MSC_SEC_CP_FN,sizeof(fn_t));      w.write(m_cp_fn.data(),n);
+
+  w.begin(MSC_SEC_CANC_LIST,sizeof(int_pair_t));
+  w.write(m_canc_list.data(),m_canc_list.size());
+
+  w.begin(MSC_SEC_CANC_PERS,sizeof(fn_t));
+  w.write(m_canc_pers.data(),m_canc_pers.size());
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+  {
+    std::vector<conn_entries_t> conn(m_conn[dir].begin(),m_conn[dir].end());
+    write_csr(w,MSC_SEC_CONN_OFFS+dir,MSC_SEC_CONN+dir,conn,n);
+  }
+
+  for(int dir = 0 ; dir < GDIR_CT && !compress_mfolds; ++dir)
+    write_csr(w,MSC_SEC_MFOLD_OFFS+dir,MSC_SEC_MFOLD+dir,m_mfolds[dir],n);
+
+  for(int dir = 0 ; dir < GDIR_CT && compress_mfolds; ++dir)
+  {
+    std::vector<uint8_t> code;
+    std::vector<uint64_t> offs(n+1,0);
+
+    for(int i = 0 ; i < n; ++i)
+    {
+      if(i < m_mfolds[dir].size())
+        encode_mfold(m_mfolds[dir][i].data(),
+                     m_mfolds[dir][i].data() + m_mfolds[dir][i].size(),code);
+
+      offs[i+1] = code.size();
+    }
+
+    w.begin(MSC_SEC_MFOLD_CODE_OFFS+dir,sizeof(uint64_t));
+    w.write(offs.data(),offs.size());
+
+    w.begin(MSC_SEC_MFOLD_CODE+dir,sizeof(uint8_t));
+    w.write(code.data(),code.size());
+  }
+
+  w.begin(MSC_SEC_DAG_NODES,sizeof(merge_dag_t::node_t));
+  w.write(m_merge_dag->m_nodes.data(),m_merge_dag->m_nodes.size());
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+  {
+    w.begin(MSC_SEC_DAG_GEOM+dir,sizeof(int));
+    w.write(m_merge_dag->m_cp_geom[dir].data(),m_merge_dag->m_cp_geom[dir].size());
+  }
+
+  if(ds)
+  {
+    int cells[] = {int(ds->m_tcc->vert_ct()),int(ds->m_tcc->edge_ct()),
+                   int(ds->m_tcc->tri_ct())};
+
+    std::vector<uint8_t> code;
+    ds->encode_gradient(code);
+
+    w.begin(MSC_SEC_GRAD_CELLS,sizeof(int)); w.write(cells,3);
+    w.begin(MSC_SEC_GRAD_CODE,sizeof(uint8_t));
+    w.write(code.data(),code.size());
+  }
+
+  w.close();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_t::load_msc(const std::string &f)
+{
+  mscomplex_view_t(f).load(*this);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool mscomplex_view_t::is_msc_file(const std::string &f)
+{
+  char magic[sizeof(msc_file_magic)];
+
+  std::fstream fs(f.c_str(),std::ios::in|std::ios::binary);
+  fs.read(magic,sizeof(magic));
+
+  return fs.good() && memcmp(magic,msc_file_magic,sizeof(magic)) == 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+template<typename T>
+const T * mscomplex_view_t::section(eMscSection s,size_t count) const
+{
+  if(count == 0)
+    return 0;
+
+  ENSUREV(m_secs[s].count == count,"msc file section has a wrong size",s);
+  ENSUREV(m_secs[s].elem_size == sizeof(T),"msc file section has a wrong type",s);
+
+  return (const T*)(m_file->data() + m_secs[s].offset);
+}
+
+/*---------------------------------------------------------------------------*/
+
+mscomplex_view_t::mscomplex_view_t(const std::string &f)
+  :m_file(new mapped_file_t(f,false))
+{
+  msc_file_header_t hdr;
+
+  ENSUREV(m_file->size() >= sizeof(hdr),"truncated msc file",f);
+
+  memcpy(&hdr,m_file->data(),sizeof(hdr));
+
+  ENSUREV(memcmp(hdr.magic,msc_file_magic,sizeof(hdr.magic)) == 0,
+          "Doesn't seem to be an msc file",f);
+  ENSUREV(hdr.version == msc_file_version,
+          "unsupported msc file version",hdr.version);
+  ENSUREV(sizeof(hdr) + hdr.num_sections*sizeof(msc_file_section_t)
+          <= m_file->size(),"truncated msc file",f);
+
+  const msc_file_section_t *secs =
+      (const msc_file_section_t*)(m_file->data() + sizeof(hdr));
+
+  for(int s = 0 ; s < MSC_SEC_CT; ++s)
+  {
+    m_secs[s].elem_size = 0;
+    m_secs[s].offset    = 0;
+    m_secs[s].count     = 0;
+  }
+
+  for(int i = 0 ; i < hdr.num_sections; ++i)
+  {
+    if(secs[i].id >= MSC_SEC_CT)
+      continue;
+
+    ENSUREV(secs[i].offset%8 == 0 &&
+            secs[i].offset + secs[i].elem_size*secs[i].count <= m_file->size(),
+            "msc file section is out of bounds",secs[i].id);
+
+    m_secs[secs[i].id].elem_size = secs[i].elem_size;
+    m_secs[secs[i].id].offset    = secs[i].offset;
+    m_secs[secs[i].id].count     = secs[i].count;
+  }
+
+  const msc_file_info_t *info = section<msc_file_info_t>(MSC_SEC_INFO,1);
+
+  int n = m_num_cps  = info->num_cps;
+  m_multires_version = info->multires_version;
+  m_fmin             = info->fmin;
+  m_fmax             = info->fmax;
+
+  m_cp_cellid     = section<cellid_t>(MSC_SEC_CP_CELLID,n);
+  m_cp_vertid     = section<cellid_t>(MSC_SEC_CP_VERTID,n);
+  m_cp_pair_idx   = section<int>(MSC_SEC_CP_PAIR_IDX,n);
+  m_cp_cancno     = section<int>(MSC_SEC_CP_CANCNO,n);
+  m_cp_index      = section<char>(MSC_SEC_CP_INDEX,n);
+  m_cp_is_boundry = section<char>(MSC_SEC_CP_BNDRY,n);
+  m_cp_fn         = section<fn_t>(MSC_SEC_CP_FN,n);
+
+  m_num_canc  = m_secs[MSC_SEC_CANC_LIST].count;
+  m_canc_list = section<int_pair_t>(MSC_SEC_CANC_LIST,m_num_canc);
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+  {
+    eMscSection co = eMscSection(MSC_SEC_CONN_OFFS+dir);
+    eMscSection mo = eMscSection(MSC_SEC_MFOLD_OFFS+dir);
+
+    m_conn_offs[dir]  = section<uint64_t>(co,(m_secs[co].count)?(n+1):(0));
+    m_mfold_offs[dir] = section<uint64_t>(mo,(m_secs[mo].count)?(n+1):(0));
+
+    m_conn[dir]  = section<conn_t::entry_t>
+        (eMscSection(MSC_SEC_CONN+dir),(m_conn_offs[dir])?(m_conn_offs[dir][n]):(0));
+    m_mfold[dir] = section<cellid_t>
+        (eMscSection(MSC_SEC_MFOLD+dir),(m_mfold_offs[dir])?(m_mfold_offs[dir][n]):(0));
+
+    eMscSection ko = eMscSection(MSC_SEC_MFOLD_CODE_OFFS+dir);
+
+    m_mfold_code_offs[dir] = section<uint64_t>(ko,(m_secs[ko].count)?(n+1):(0));
+    m_mfold_code[dir]      = section<uint8_t>
+        (eMscSection(MSC_SEC_MFOLD_CODE+dir),
+         (m_mfold_code_offs[dir])?(m_mfold_code_offs[dir][n]):(0));
+  }
+
+  m_grad_cells = section<int>(MSC_SEC_GRAD_CELLS,(m_secs[MSC_SEC_GRAD_CELLS].count)?(3):(0));
+  m_grad_code  = section<uint8_t>(MSC_SEC_GRAD_CODE,(m_grad_cells)?(m_secs[MSC_SEC_GRAD_CODE].count):(0));
+}
+
+/*---------------------------------------------------------------------------*/
+
+mscomplex_view_t::~mscomplex_view_t(){}
+
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_view_t::load(mscomplex_t &msc) const
+{
+  int n = m_num_cps;
+
+  msc.clear();
+  msc.resize(n);
+
+  std::copy(m_cp_cellid,m_cp_cellid+n,msc.m_cp_cellid.begin());
+  std::copy(m_cp_vertid,m_cp_vertid+n,msc.m_cp_vertid.begin());
+  std::copy(m_cp_pair_idx,m_cp_pair_idx+n,msc.m_cp_pair_idx.begin());
+  std::copy(m_cp_cancno,m_cp_cancno+n,msc.m_cp_cancno.begin());
+  std::copy(m_cp_index,m_cp_index+n,msc.m_cp_index.begin());
+  std::copy(m_cp_is_boundry,m_cp_is_boundry+n,msc.m_cp_is_boundry.begin());
+  std::copy(m_cp_fn,m_cp_fn+n,msc.m_cp_fn.begin());
+
+  msc.m_multires_version = m_multires_version;
+  msc.m_fmin             = m_fmin;
+  msc.m_fmax             = m_fmax;
+
+  msc.m_canc_list.assign(m_canc_list,m_canc_list + m_num_canc);
+
+  const fn_t *pers = section<fn_t>(MSC_SEC_CANC_PERS,m_secs[MSC_SEC_CANC_PERS].count);
+  msc.m_canc_pers.assign(pers,pers + m_secs[MSC_SEC_CANC_PERS].count);
+
+#pragma omp parallel for schedule(dynamic,256)
+  for(int i = 0 ; i < n; ++i)
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+    {
+      if(m_conn_offs[dir])
+        msc.m_conn[dir][i].assign(m_conn[dir] + m_conn_offs[dir][i],
+                                  m_conn[dir] + m_conn_offs[dir][i+1]);
+
+      get_mfold(eGDIR(dir),i,msc.m_mfolds[dir][i]);
+    }
+
+  const merge_dag_t::node_t *nodes = section<merge_dag_t::node_t>
+      (MSC_SEC_DAG_NODES,m_secs[MSC_SEC_DAG_NODES].count);
+
+  msc.m_merge_dag->m_nodes.assign(nodes,nodes + m_secs[MSC_SEC_DAG_NODES].count);
+
+  for(int dir = 0 ; dir < GDIR_CT; ++dir)
+  {
+    eMscSection g = eMscSection(MSC_SEC_DAG_GEOM+dir);
+    const int *geom = section<int>(g,m_secs[g].count);
+    msc.m_merge_dag->m_cp_geom[dir].assign(geom,geom + m_secs[g].count);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mscomplex_view_t::load_gradient(dataset_t &ds) const
+{
+  ENSURE(has_gradient(),"msc file has no gradient section");
+
+  const tri_cc_t &tcc = *ds.m_tcc;
+
+  ENSURE(m_grad_cells[0] == tcc.vert_ct() && m_grad_cells[1] == tcc.edge_ct() &&
+         m_grad_cells[2] == tcc.tri_ct(),
+         "msc file gradient is not of the mesh of the dataset");
+
+  ds.decode_gradient(m_grad_code,m_secs[MSC_SEC_GRAD_CODE].count);
+}
+
+/*===========================================================================*/
+
 template<>
 int_pair_t order_by_dir_index<DES>(mscomplex_ptr_t msc,int_pair_t pr)
 {if(msc->index(pr.first) < msc->index(pr.second))std::swap(pr.first,pr.second);return pr;}
@@ -23,23 +23,112 @@
 
 #include <set>
 #include <map>
+#include <list>
 
 #include <iostream>
 #include <fstream>
 
+#include <stdint.h>
+
 #include <boost/noncopyable.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/iterator/counting_iterator.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 
 #include <trimesh.h>
 
 
 namespace trimesh
 {
-  typedef std::multiset<uint>                 conn_t;
-  typedef std::multiset<uint>::iterator       conn_iter_t;
-  typedef std::multiset<uint>::const_iterator const_conn_iter_t;
+  /// \brief Connections of a cp stored as (cp,multiplicity) entries sorted
+  ///        by cp. Iterates like the std::multiset<uint> it replaces.
+  /// \note  Most cps are saddles with 2 connections in each direction. So
+  ///        the first few entries are held inline and need no allocation.
+  class conn_t
+  {
+  public:
+
+    struct entry_t {uint cp; uint ct;};
+
+    class const_iterator:public boost::iterator_facade
+        <const_iterator,const uint,boost::forward_traversal_tag>
+    {
+    public:
+      const_iterator():m_e(0),m_i(0){}
+      explicit const_iterator(const entry_t *e):m_e(e),m_i(0){}
+
+    private:
+      friend class boost::iterator_core_access;
+
+      inline void increment()
+      {if(++m_i == m_e->ct){++m_e;m_i = 0;}}
+
+      inline bool equal(const const_iterator &o) const
+      {return m_e == o.m_e && m_i == o.m_i;}
+
+      inline const uint& dereference() const
+      {return m_e->cp;}
+
+      const entry_t *m_e;
+      uint           m_i;
+    };
+
+    typedef const_iterator iterator;
+    typedef uint           value_type;
+
+    conn_t();
+    conn_t(const conn_t &);
+    conn_t & operator=(const conn_t &);
+    ~conn_t();
+
+    inline const_iterator begin() const {return const_iterator(data());}
+    inline const_iterator end() const {return const_iterator(data() + m_n);}
+
+    /// \brief add one copy of c
+    inline void insert(uint c);
+
+    /// \brief remove all copies of c and return how many were removed
+    inline uint erase(uint c);
+
+    /// \brief remove one copy of c
+    inline void erase_one(uint c);
+
+    inline uint count(uint c) const;
+    inline uint size() const;
+    inline bool empty() const {return m_n == 0;}
+    void clear();
+
+    /// \brief the (cp,multiplicity) entries sorted by cp
+    inline const entry_t * entries() const {return data();}
+    inline uint num_entries() const {return m_n;}
+
+    /// \brief replace the contents by the entries [b,e) sorted by cp
+    void assign(const entry_t *b,const entry_t *e);
+
+  private:
+
+    static const uint s_ninline = 2;
+
+    inline entry_t * data() {return (m_cap == s_ninline)?(m_inline):(m_heap);}
+    inline const entry_t * data() const {return (m_cap == s_ninline)?(m_inline):(m_heap);}
+
+    inline entry_t * lower_bound(uint c);
+    void reserve(uint cap);
+
+    uint m_n;
+    uint m_cap;
+
+    union
+    {
+      entry_t  m_inline[s_ninline];
+      entry_t *m_heap;
+    };
+  };
+
+  typedef conn_t::const_iterator              conn_iter_t;
+  typedef conn_t::const_iterator              const_conn_iter_t;
   typedef std::vector<conn_t>                 conn_list_t;
 
   typedef cellid_list_t            mfold_t;
@@ -47,6 +136,21 @@ namespace trimesh
 
   class merge_dag_t;
 
+  /// \brief The pairs and connections of all cps at one multires version
+  /// \note  Connections are kept as offsets and entries, as in the conn
+  ///        sections of msc files, and not as conn_t's.
+  struct multires_checkpoint_t
+  {
+    int                          version;
+    int_list_t                   pair_idx;
+    std::vector<uint64_t>        conn_offs[GDIR_CT];
+    std::vector<conn_t::entry_t> conn[GDIR_CT];
+
+    size_t bytes() const;
+  };
+
+  typedef std::vector<multires_checkpoint_t> multires_checkpoint_list_t;
+
   class mscomplex_t:public boost::enable_shared_from_this<mscomplex_t>
   {
   public:
@@ -75,6 +179,14 @@ namespace trimesh
 
     int m_multires_version;
 
+    // Absolute threshold of the simplify calls so far, so that the
+    // simplification can be redone locally (see mscomplex_edit_t). -1 if
+    // there were none and -2 if it cannot be redone (cps counts, hand
+    // picked cancellations).
+    double m_simp_tresh;
+
+    multires_checkpoint_list_t m_checkpoints; // by version
+
     boost::shared_ptr<merge_dag_t>
                   m_merge_dag;
 
@@ -117,12 +229,29 @@ namespace trimesh
   public:
 
     void simplify(double f_tresh, bool is_nrm=false, int req_nmin=0, int req_nmax=0);
+    /// \note  Starts from the nearest checkpoint below version, if that
+    ///        replays fewer cancellations than going from the current one
     void set_multires_version(int version);
+
+    /// \brief Snapshot the pairs and connections at evenly spaced versions,
+    ///        in at most max_bytes, so that any version is reached by
+    ///        a restore and a bounded replay (see set_multires_version)
+    /// \note  Later simplification only adds versions past the last one, so
+    ///        the checkpoints stay good. clear() and loads drop them.
+    void make_multires_checkpoints(size_t max_bytes);
+
     inline int  get_multires_version() const {return m_multires_version;}
     int  get_multires_version_for_thresh(double t,bool is_nrm=false) const;
 
     void collect_mfolds(eGDIR dir, int dim, dataset_ptr_t ds);
     void collect_mfolds(dataset_ptr_t ds);
+
+    /// \brief Dense labels of the dim cells: the index of the surviving cp
+    ///        whose dir manifold holds each cell, -1 if none
+    /// \note  (DES,2) tris->maxima and (ASC,0) verts->minima are read off the
+    ///        owners of the cells in one pass. (DES,1)/(ASC,1) edges->saddles
+    ///        are traversed. An edge on many arcs gets the lowest cp.
+    void get_mfold_labels(eGDIR dir,int dim,dataset_ptr_t ds,int_list_t &labels);
     void get_mfold(eGDIR dir, int cp,cellid_list_t &mfold,int ver=-1);
     void get_contrib(eGDIR dir, int cp,int_list_t &contrib,int ver=-1);
 
@@ -140,6 +269,14 @@ namespace trimesh
     void save_bin(std::ostream &os) const;
     void load_bin(std::istream &is);
 
+    /// \brief Save/load in the sectioned msc file format
+    /// \note  load() takes either format. Manifolds are delta varint coded
+    ///        if compress_mfolds is set (see encode_mfold). If ds is given
+    ///        its gradient is saved too (see mscomplex_view_t::load_gradient).
+    void save_msc(const std::string &f,bool compress_mfolds=false,
+                  dataset_ptr_t ds=dataset_ptr_t()) const;
+    void load_msc(const std::string &f);
+
     template<class Archive>
     void serialize(Archive & ar, const unsigned int /* file_version */);
 
@@ -157,6 +294,277 @@ namespace trimesh
 
   };
 
+  /// \brief Changes a few cps of a simplified complex in place and redoes
+  ///        the simplification only around them (see dataset_t::update)
+  /// \note  A paired cp's conn lists stay as they were when it was
+  ///        cancelled. So a cancellation touches p, q and the cps in their
+  ///        lists, and cancellations that touch disjoint cps commute. The
+  ///        constructor undoes, out of order, the cancellations that touch
+  ///        the given cps or the cps touched by an earlier undone one. The
+  ///        others stay cancelled. commit() cancels greedily around the
+  ///        touched cps, up to m_simp_tresh, and merges these with the kept
+  ///        ones by persistence. If a new cancellation lands before a kept
+  ///        one that it touches, the kept one is undone too and this is
+  ///        redone. So m_canc_list is as simplify would give on the changed
+  ///        complex, though cps are not renumbered.
+  /// \note  The scans for the cancellations to undo read the conn lists of
+  ///        all of them. They are flat and far cheaper than a replay.
+  class mscomplex_edit_t : boost::noncopyable
+  {
+  public:
+    /// \brief Undo the cancellations around cps
+    /// \note  cps are then unpaired, with their unsimplified connections.
+    ///        Until commit, only cps may be reset, have connections removed
+    ///        or be connected to one another, and cps may be appended. A
+    ///        kept cancellation that reads a connection of one of cps
+    ///        touches that cp, so it is not kept.
+    mscomplex_edit_t(mscomplex_t &msc,const int_list_t &cps);
+
+    /// \brief Redo the simplification around the changed cps
+    /// \note  The complex is left at its coarsest version. Checkpoints and
+    ///        collected manifolds are dropped.
+    void commit();
+
+  private:
+    inline void add(int cp);
+    void undo_touching();
+    void simplify_rgn(int_pair_list_t &cancs);
+
+    mscomplex_t &m_msc;
+    int_list_t   m_mark; // 0 for cps in m_rgn
+    int_list_t   m_rgn;  // cps whose conn lists may differ from before
+    int_list_t   m_kept; // positions in m_canc_list that stay cancelled
+  };
+
+  /// \brief Traverses manifolds only when they are asked for
+  /// \note  The most recently used manifolds are kept, up to max_cells
+  ///        cells in all. The cancelled cps that contribute to each
+  ///        surviving cp are worked out once per (dir,index), and again if
+  ///        the multires version of the complex changes.
+  class mfold_cache_t : boost::noncopyable
+  {
+  public:
+    mfold_cache_t(mscomplex_ptr_t msc,dataset_ptr_t ds,size_t max_cells);
+
+    /// \brief The manifold of cp in dir (empty for cancelled cps)
+    /// \note  The reference is good till the next call
+    const mfold_t & get(eGDIR dir,int cp);
+
+    void clear();
+
+    inline size_t num_cells() const {return m_num_cells;}
+    inline size_t max_cells() const {return m_max_cells;}
+
+  private:
+    typedef std::map<int,int_list_t>               contrib_t;
+    typedef std::list<std::pair<int,mfold_t> >     lru_t;
+
+    const contrib_t & get_contrib(eGDIR dir,int dim);
+
+    boost::weak_ptr<mscomplex_t>   m_msc; // the msc may own the cache
+    dataset_ptr_t                  m_ds;
+
+    contrib_t                      m_contrib[GDIR_CT][gc_max_cell_dim+1];
+    bool                           m_has_contrib[GDIR_CT][gc_max_cell_dim+1];
+    int                            m_version;
+
+    lru_t                          m_lru;
+    std::map<int,lru_t::iterator>  m_index;
+    size_t                         m_num_cells;
+    size_t                         m_max_cells;
+  };
+
+  /**
+    \brief Sectioned msc files
+
+    A header and a table of sections followed by the sections. Each section
+    is a flat array and starts at an 8 byte aligned offset. Everything is
+    little endian.
+
+    char     magic[8]   = "MSTRIMSC"
+    uint32   version    = 1
+    uint32   num_sections
+    struct {uint32 id; uint32 elem_size; uint64 offset; uint64 count;}
+             sections[num_sections]
+
+    Per cp data is stored one array per field. The connections and the
+    manifolds of each dir are stored as a uint64 offset table with one
+    entry per cp (+1) and the concatenated lists. So a reader can get at
+    any cp's manifold without touching any other. Manifolds may instead be
+    stored coded by encode_mfold, with the offsets counting bytes.
+
+    Readers skip sections with ids they do not know. So sections can be
+    added without a version change. The connection, manifold, cancellation
+    and dag sections may be left out.
+
+    The gradient section, if there is one, holds the pairs of the dataset
+    the complex was made from (see dataset_t::encode_gradient). With it the
+    manifolds of a loaded complex can be traversed again on the same mesh
+    without dataset_t::work.
+  **/
+
+  class mapped_file_t;
+
+  enum eMscSection
+  {
+    MSC_SEC_INFO,        // {uint32 num_cps; int32 multires_version;
+                         //  float64 fmin; float64 fmax}
+    MSC_SEC_CP_CELLID,   // int32 per cp
+    MSC_SEC_CP_VERTID,   // int32 per cp
+    MSC_SEC_CP_PAIR_IDX, // int32 per cp
+    MSC_SEC_CP_CANCNO,   // int32 per cp
+    MSC_SEC_CP_INDEX,    // int8 per cp
+    MSC_SEC_CP_BNDRY,    // int8 per cp
+    MSC_SEC_CP_FN,       // float64 per cp
+    MSC_SEC_CANC_LIST,   // int32 pairs
+    MSC_SEC_CANC_PERS,   // float64 per cancellation
+    MSC_SEC_CONN_OFFS,   // des,asc: uint64 per cp + 1
+    MSC_SEC_CONN = MSC_SEC_CONN_OFFS + GDIR_CT,   // des,asc: conn_t::entry_t
+    MSC_SEC_MFOLD_OFFS = MSC_SEC_CONN + GDIR_CT,  // des,asc: uint64 per cp + 1
+    MSC_SEC_MFOLD = MSC_SEC_MFOLD_OFFS + GDIR_CT, // des,asc: int32 cellids
+    MSC_SEC_DAG_NODES = MSC_SEC_MFOLD + GDIR_CT,  // int32 {base,other,canc_no}
+    MSC_SEC_DAG_GEOM,    // des,asc: int32 per cp
+    MSC_SEC_MFOLD_CODE_OFFS = MSC_SEC_DAG_GEOM + GDIR_CT,  // des,asc: uint64 per cp + 1
+    MSC_SEC_MFOLD_CODE = MSC_SEC_MFOLD_CODE_OFFS + GDIR_CT,// des,asc: encode_mfold bytes
+    MSC_SEC_GRAD_CELLS = MSC_SEC_MFOLD_CODE + GDIR_CT,     // int32 vert,edge,tri counts
+    MSC_SEC_GRAD_CODE,   // encode_gradient bytes
+    MSC_SEC_CT
+  };
+
+  /// \brief Append the delta varint code of the cells [b,e) to code
+  /// \note  Each cell is coded as the zigzagged difference from the cell
+  ///        before it, 7 bits a byte, low bits first. Cells that follow one
+  ///        another in a manifold are mostly close by, so they take one or
+  ///        two bytes. The order of the cells is kept.
+  void encode_mfold(const cellid_t *b,const cellid_t *e,
+                    std::vector<uint8_t> &code);
+
+  /// \brief Append the cells coded in [b,e) to m
+  void decode_mfold(const uint8_t *b,const uint8_t *e,mfold_t &m);
+
+  /// \brief Read only random access to a sectioned msc file through an mmap
+  /// \note  Nothing is copied on open. Only the pages of the cps,
+  ///        connections and manifolds that are asked for are read in.
+  class mscomplex_view_t
+  {
+  public:
+    mscomplex_view_t(const std::string &f);
+    ~mscomplex_view_t();
+
+    static bool is_msc_file(const std::string &f);
+
+    typedef boost::iterator_range<conn_iter_t>     conn_range_t;
+    typedef boost::iterator_range<const cellid_t*> mfold_range_t;
+
+    inline int  get_num_critpts() const {return m_num_cps;}
+    inline int  get_multires_version() const {return m_multires_version;}
+    inline fn_t fmin() const {return m_fmin;}
+    inline fn_t fmax() const {return m_fmax;}
+
+    inline int      index(int i)      const {return m_cp_index[i];}
+    inline int      pair_idx(int i)   const {return m_cp_pair_idx[i];}
+    inline int      cancno(int i)     const {return m_cp_cancno[i];}
+    inline bool     is_boundry(int i) const {return m_cp_is_boundry[i];}
+    inline cellid_t cellid(int i)     const {return m_cp_cellid[i];}
+    inline cellid_t vertid(int i)     const {return m_cp_vertid[i];}
+    inline fn_t     fn(int i)         const {return m_cp_fn[i];}
+
+    /// \brief The per cp arrays, read in place
+    inline const cellid_t * cp_cellid()     const {return m_cp_cellid;}
+    inline const cellid_t * cp_vertid()     const {return m_cp_vertid;}
+    inline const int *      cp_pair_idx()   const {return m_cp_pair_idx;}
+    inline const char *     cp_index()      const {return m_cp_index;}
+    inline const char *     cp_is_boundry() const {return m_cp_is_boundry;}
+    inline const fn_t *     cp_fn()         const {return m_cp_fn;}
+
+    inline int        num_canc() const {return m_num_canc;}
+    inline int_pair_t canc(int i) const {return m_canc_list[i];}
+
+    /// \note empty if the file has no connections/manifolds
+    inline conn_range_t  conn(eGDIR dir,int i) const;
+
+    /// \brief Append the manifold of cp i to m.. decoded if need be
+    inline void get_mfold(eGDIR dir,int i,mfold_t &m) const;
+
+    /// \brief The cells of an uncoded manifold, read in place
+    /// \note  empty if the manifolds are coded
+    inline mfold_range_t mfold(eGDIR dir,int i) const;
+    inline bool is_mfold_coded(eGDIR dir) const {return m_mfold_code_offs[dir] != 0;}
+
+    /// \brief Copy the whole complex into msc
+    void load(mscomplex_t &msc) const;
+
+    inline bool has_gradient() const {return m_grad_code != 0;}
+
+    /// \brief Decode the gradient section, in place, into ds
+    /// \note  ds must be made on the mesh this complex was computed on,
+    ///        with its tris in the same order. Only the cell counts are
+    ///        checked.
+    void load_gradient(dataset_t &ds) const;
+
+  private:
+    template<typename T>
+    const T * section(eMscSection s,size_t count) const;
+
+    boost::shared_ptr<mapped_file_t> m_file;
+
+    struct section_t {size_t elem_size,offset,count;};
+
+    section_t m_secs[MSC_SEC_CT];
+
+    int  m_num_cps;
+    int  m_num_canc;
+    int  m_multires_version;
+    fn_t m_fmin;
+    fn_t m_fmax;
+
+    const cellid_t          *m_cp_cellid;
+    const cellid_t          *m_cp_vertid;
+    const int               *m_cp_pair_idx;
+    const int               *m_cp_cancno;
+    const char              *m_cp_index;
+    const char              *m_cp_is_boundry;
+    const fn_t              *m_cp_fn;
+    const int_pair_t        *m_canc_list;
+    const uint64_t          *m_conn_offs[GDIR_CT];
+    const conn_t::entry_t   *m_conn[GDIR_CT];
+    const uint64_t          *m_mfold_offs[GDIR_CT];
+    const cellid_t          *m_mfold[GDIR_CT];
+    const uint64_t          *m_mfold_code_offs[GDIR_CT];
+    const uint8_t           *m_mfold_code[GDIR_CT];
+    const int               *m_grad_cells;
+    const uint8_t           *m_grad_code;
+  };
+
+  inline mscomplex_view_t::conn_range_t
+  mscomplex_view_t::conn(eGDIR dir,int i) const
+  {
+    if(m_conn_offs[dir] == 0)
+      return conn_range_t();
+
+    return conn_range_t(conn_iter_t(m_conn[dir] + m_conn_offs[dir][i]),
+                        conn_iter_t(m_conn[dir] + m_conn_offs[dir][i+1]));
+  }
+
+  inline mscomplex_view_t::mfold_range_t
+  mscomplex_view_t::mfold(eGDIR dir,int i) const
+  {
+    if(m_mfold_offs[dir] == 0)
+      return mfold_range_t();
+
+    return mfold_range_t(m_mfold[dir] + m_mfold_offs[dir][i],
+                         m_mfold[dir] + m_mfold_offs[dir][i+1]);
+  }
+
+  inline void mscomplex_view_t::get_mfold(eGDIR dir,int i,mfold_t &m) const
+  {
+    if(is_mfold_coded(dir))
+      decode_mfold(m_mfold_code[dir] + m_mfold_code_offs[dir][i],
+                   m_mfold_code[dir] + m_mfold_code_offs[dir][i+1],m);
+    else
+      m.insert(m.end(),mfold(dir,i).begin(),mfold(dir,i).end());
+  }
+
 }
 
 #include <trimesh_mscomplex_ensure.h>
@@ -1,6 +1,7 @@
 #ifndef TRIMESH_MSCOMPLEX_ENSURE_H_INCLUDED
 #define TRIMESH_MSCOMPLEX_ENSURE_H_INCLUDED
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <boost/bind.hpp>
@@ -10,6 +11,82 @@
 namespace trimesh
 {
 
+inline bool conn_entry_lt(const conn_t::entry_t &e,uint c)
+{return e.cp < c;}
+
+inline conn_t::entry_t * conn_t::lower_bound(uint c)
+{return std::lower_bound(data(),data() + m_n,c,conn_entry_lt);}
+
+inline void conn_t::insert(uint c)
+{
+  entry_t *b = lower_bound(c);
+
+  if(b != data() + m_n && b->cp == c)
+  {
+    b->ct++;
+    return;
+  }
+
+  int i = b - data();
+
+  if(m_n == m_cap)
+    reserve(2*m_cap);
+
+  b = data() + i;
+
+  std::copy_backward(b,data() + m_n,data() + m_n + 1);
+
+  b->cp = c;
+  b->ct = 1;
+  m_n++;
+}
+
+inline uint conn_t::erase(uint c)
+{
+  entry_t *b = lower_bound(c),*e = data() + m_n;
+
+  if(b == e || b->cp != c)
+    return 0;
+
+  uint ct = b->ct;
+
+  std::copy(b+1,e,b);
+  m_n--;
+
+  return ct;
+}
+
+inline void conn_t::erase_one(uint c)
+{
+  entry_t *b = lower_bound(c);
+
+  ASSERT(b != data() + m_n && b->cp == c);
+
+  if(--b->ct == 0)
+  {
+    std::copy(b+1,data() + m_n,b);
+    m_n--;
+  }
+}
+
+inline uint conn_t::count(uint c) const
+{
+  const entry_t *e = data() + m_n;
+  const entry_t *b = std::lower_bound(data(),e,c,conn_entry_lt);
+
+  return (b != e && b->cp == c)?(b->ct):(0);
+}
+
+inline uint conn_t::size() const
+{
+  uint n = 0;
+
+  for(const entry_t *b = data(),*e = b + m_n; b != e; ++b)
+    n += b->ct;
+
+  return n;
+}
+
 inline void order_pr_by_cp_index(const mscomplex_t &msc,int &p,int &q)
 {if(msc.index(p) < msc.index(q))std::swap(p,q);}
 
@@ -162,6 +239,12 @@ inline void mscomplex_t::save(const std::string &f) const
 }
 inline void mscomplex_t::load(const std::string &f)
 {
+  if(mscomplex_view_t::is_msc_file(f))
+  {
+    load_msc(f);
+    return;
+  }
+
   std::fstream fs(f.c_str(),std::ios::in|std::ios::binary);
   ENSUREV(fs.is_open(),"file not found!!",f);
   load_bin(fs);
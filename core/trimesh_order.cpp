@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <numeric>
+
+#include <trimesh_order.h>
+#include <trimesh_mscomplex.h>
+
+using namespace std;
+
+namespace trimesh
+{
+
+/*===========================================================================*/
+
+/// \brief Orders verts by their degree and then by their id
+struct degree_lt_t
+{
+  const int_list_t &deg;
+  degree_lt_t(const int_list_t &d):deg(d){}
+
+  inline bool operator()(int a,int b) const
+  {return (deg[a] != deg[b])?(deg[a] < deg[b]):(a < b);}
+};
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::reorder(fn_list_t &fns,tri_idx_list_t &tlist)
+{
+  int N = fns.size(), T = tlist.size();
+
+  // vert adjacency in csr form.. each tri edge is listed from both ends
+  int_list_t offs(N+1,0),adj,deg(N);
+
+  for(int t = 0 ; t < T; ++t)
+    for(int u = 0 ; u < 3; ++u)
+    {
+      ENSUREV(is_in_range(tlist[t][u],0,N),"invalid index in tri",t);
+      offs[tlist[t][u]+1] += 2;
+    }
+
+  partial_sum(offs.begin(),offs.end(),offs.begin());
+
+  adj.resize(offs[N]);
+  int_list_t pos(offs.begin(),offs.end()-1);
+
+  for(int t = 0 ; t < T; ++t)
+    for(int u = 0 ; u < 3; ++u)
+    {
+      int a = tlist[t][u], b = tlist[t][(u+1)%3];
+      adj[pos[a]++] = b;
+      adj[pos[b]++] = a;
+    }
+
+  for(int v = 0 ; v < N; ++v)
+  {
+    int *b = adj.data() + offs[v], *e = adj.data() + offs[v+1];
+    sort(b,e);
+    deg[v] = unique(b,e) - b;
+  }
+
+  // Cuthill-McKee, one component at a time. Each component is started at
+  // the last vert that a bfs from its first vert reaches.
+  int_list_t order,seen(N,-1),old2new(N,-1);
+  order.reserve(N);
+
+  int_list_t q;
+  q.reserve(N);
+
+  for(int s = 0 ; s < N; ++s)
+  {
+    if(old2new[s] != -1)
+      continue;
+
+    q.clear();
+    q.push_back(s);
+    seen[s] = s;
+
+    for(int i = 0 ; i < q.size(); ++i)
+      for(int j = offs[q[i]], je = offs[q[i]] + deg[q[i]]; j < je; ++j)
+        if(seen[adj[j]] != s)
+        {
+          seen[adj[j]] = s;
+          q.push_back(adj[j]);
+        }
+
+    int r = q.back();
+
+    old2new[r] = 0;
+    order.push_back(r);
+
+    for(int i = order.size()-1 ; i < order.size(); ++i)
+    {
+      int v = order[i], nb = order.size();
+
+      for(int j = offs[v], je = offs[v] + deg[v]; j < je; ++j)
+        if(old2new[adj[j]] == -1)
+        {
+          old2new[adj[j]] = 0;
+          order.push_back(adj[j]);
+        }
+
+      sort(order.begin()+nb,order.end(),degree_lt_t(deg));
+    }
+  }
+
+  reverse(order.begin(),order.end());
+
+  for(int i = 0 ; i < N; ++i)
+    old2new[order[i]] = i;
+
+  // tris sorted by their lowest vert.. counting sort keeps the input order
+  // among tris that share it
+  fill(offs.begin(),offs.end(),0);
+
+  for(int t = 0 ; t < T; ++t)
+    offs[min(old2new[tlist[t][0]],min(old2new[tlist[t][1]],old2new[tlist[t][2]]))+1]++;
+
+  partial_sum(offs.begin(),offs.end(),offs.begin());
+
+  m_tri_new2old.resize(T);
+
+  for(int t = 0 ; t < T; ++t)
+    m_tri_new2old[offs[min(old2new[tlist[t][0]],min(old2new[tlist[t][1]],old2new[tlist[t][2]]))]++] = t;
+
+  fn_list_t      nfns(N);
+  tri_idx_list_t ntlist(T);
+
+  for(int i = 0 ; i < N; ++i)
+    nfns[i] = fns[order[i]];
+
+  for(int t = 0 ; t < T; ++t)
+    for(int u = 0 ; u < 3; ++u)
+      ntlist[t][u] = old2new[tlist[m_tri_new2old[t]][u]];
+
+  fns.swap(nfns);
+  tlist.swap(ntlist);
+  m_vert_new2old.swap(order);
+
+  m_cell_new2old.clear();
+  m_cell_old2new.clear();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::reorder_fns(fn_list_t &fns) const
+{
+  int N = m_vert_new2old.size();
+
+  ENSUREV(fns.size() == N,"fn is not on the reordered mesh",fns.size());
+
+  fn_list_t nfns(N);
+
+  for(int i = 0 ; i < N; ++i)
+    nfns[i] = fns[m_vert_new2old[i]];
+
+  fns.swap(nfns);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::map_cells(const tri_cc_t &tcc)
+{
+  int V = tcc.vert_ct(), E = tcc.edge_ct(), T = tcc.tri_ct();
+
+  ENSURE(V == m_vert_new2old.size() && T == m_tri_new2old.size(),
+         "tri_cc_t is not of the reordered mesh");
+
+  m_cell_new2old.resize(V+E+T);
+  m_cell_old2new.resize(V+E+T);
+
+  for(int v = 0 ; v < V; ++v)
+    m_cell_new2old[v] = m_vert_new2old[v];
+
+  // The input order numbers each edge by its first half edge. So rank the
+  // edges by the lower input index of their half edges.
+  int_list_t first(3*T,-1);
+
+  for(int e = 0 ; e < E; ++e)
+  {
+    uint h = tcc.m_edges[e];
+    int  k = 3*m_tri_new2old[h/3] + h%3;
+
+    if(tcc.has_fnext(h))
+    {
+      uint g = tcc.fnext(h);
+      k = min<int>(k,3*m_tri_new2old[g/3] + g%3);
+    }
+
+    first[k] = e;
+  }
+
+  for(int k = 0,r = 0 ; k < 3*T; ++k)
+    if(first[k] != -1)
+      m_cell_new2old[V + first[k]] = V + r++;
+
+  for(int t = 0 ; t < T; ++t)
+    m_cell_new2old[V+E+t] = V + E + m_tri_new2old[t];
+
+  for(int c = 0 ; c < V+E+T; ++c)
+    m_cell_old2new[m_cell_new2old[c]] = c;
+}
+
+/*---------------------------------------------------------------------------*/
+
+inline void relabel_cells(mscomplex_t &msc,const cellid_list_t &m)
+{
+  ENSURE(m.size() != 0,"cellid maps not built.. call map_cells first");
+
+  int n = msc.get_num_critpts();
+
+  for(int i = 0 ; i < n; ++i)
+  {
+    msc.m_cp_cellid[i] = m[msc.m_cp_cellid[i]];
+    msc.m_cp_vertid[i] = m[msc.m_cp_vertid[i]];
+  }
+
+#pragma omp parallel for schedule(dynamic,64)
+  for(int i = 0 ; i < n; ++i)
+    for(int dir = 0 ; dir < GDIR_CT; ++dir)
+      if(i < msc.m_mfolds[dir].size())
+        for(mfold_t::iterator it = msc.m_mfolds[dir][i].begin();
+            it != msc.m_mfolds[dir][i].end(); ++it)
+          *it = m[*it];
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::to_original(mscomplex_t &msc) const
+{relabel_cells(msc,m_cell_new2old);}
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::to_reordered(mscomplex_t &msc) const
+{relabel_cells(msc,m_cell_old2new);}
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::to_original_labels(int dim,int_list_t &labels) const
+{
+  ENSURE(m_cell_new2old.size() != 0,"cellid maps not built.. call map_cells first");
+
+  int V = m_vert_new2old.size(), T = m_tri_new2old.size();
+  int E = m_cell_new2old.size() - V - T;
+
+  int off = (dim == 0)?(0):((dim == 1)?(V):(V+E));
+  int N   = (dim == 0)?(V):((dim == 1)?(E):(T));
+
+  ENSUREV(labels.size() == N,"labels are not of the reordered mesh",labels.size());
+
+  int_list_t olabels(N);
+
+  for(int c = 0 ; c < N; ++c)
+    olabels[m_cell_new2old[c+off]-off] = labels[c];
+
+  labels.swap(olabels);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void mesh_order_t::collect_mfolds(mscomplex_ptr_t msc,dataset_ptr_t ds) const
+{
+  to_reordered(*msc);
+  msc->collect_mfolds(ds);
+  to_original(*msc);
+}
+
+/*===========================================================================*/
+
+}
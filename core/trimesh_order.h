@@ -0,0 +1,54 @@
+#ifndef TRIMESH_ORDER_H_INCLUDED
+#define TRIMESH_ORDER_H_INCLUDED
+
+#include <trimesh.h>
+
+namespace trimesh
+{
+  /// \brief Relabels the verts and tris of a mesh so that cells that are
+  ///        close on the mesh are close in the dataset_t arrays
+  ///
+  /// \note  Verts are put in reverse Cuthill-McKee order and tris are then
+  ///        sorted by their lowest vert. The corners of each tri keep their
+  ///        order, so orientations are unchanged.
+  ///
+  /// \note  Ties in fn are broken on vert ids. So on inputs with repeated
+  ///        values the reordered complex can differ from that of the input
+  ///        order, just as for any other relabelling of the input file.
+  class mesh_order_t
+  {
+  public:
+
+    /// \brief Reorder fns and tlist in place
+    void reorder(fn_list_t &fns,tri_idx_list_t &tlist);
+
+    /// \brief Put another fn on the same mesh in the order of the last reorder
+    void reorder_fns(fn_list_t &fns) const;
+
+    /// \brief Build the cellid maps from the tri_cc_t of the reordered mesh
+    void map_cells(const tri_cc_t &tcc);
+
+    inline cellid_t to_original(cellid_t c) const {return m_cell_new2old[c];}
+    inline cellid_t to_reordered(cellid_t c) const {return m_cell_old2new[c];}
+
+    /// \brief Relabel the cellids, vertids and manifolds of msc
+    void to_original(mscomplex_t &msc) const;
+    void to_reordered(mscomplex_t &msc) const;
+
+    /// \brief Put the labels of the dim cells of the reordered mesh
+    ///        (see mscomplex_t::get_mfold_labels) in the original order
+    void to_original_labels(int dim,int_list_t &labels) const;
+
+    /// \brief Collect the manifolds of msc, which is in the original
+    ///        numbering, from ds, which is built on the reordered mesh
+    void collect_mfolds(mscomplex_ptr_t msc,dataset_ptr_t ds) const;
+
+  private:
+    int_list_t    m_vert_new2old;
+    int_list_t    m_tri_new2old;
+    cellid_list_t m_cell_new2old;
+    cellid_list_t m_cell_old2new;
+  };
+}
+
+#endif
@@ -0,0 +1,574 @@
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <sstream>
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <boost/typeof/typeof.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include <trimesh_partition.h>
+#include <trimesh_dataset.h>
+#include <trimesh_mscomplex.h>
+#include <trimesh_io.h>
+
+using namespace std;
+
+namespace trimesh
+{
+
+/*===========================================================================*/
+
+partition_t::partition_t
+(const mesh_bin_view_t &mesh,int num_blocks,int num_rings,
+ dataset_t::eGradient grad):
+  m_mesh(mesh),m_num_blocks(num_blocks),m_num_rings(num_rings),
+  m_gradient(grad),m_vtri(mesh)
+{
+  ENSUREV(num_blocks > 0,"need at least one block",num_blocks);
+  ENSUREV(num_rings >= min_rings(grad),"too few ghost rings for the gradient",
+          num_rings);
+}
+
+/*---------------------------------------------------------------------------*/
+
+int partition_t::min_rings(dataset_t::eGradient grad)
+{
+  return (grad == dataset_t::GRAD_LOWER_STAR)?(1):(2);
+}
+
+/*---------------------------------------------------------------------------*/
+
+inline uint partition_t::block_begin(int b) const
+{return (uint64_t(m_mesh.num_tris())*b)/m_num_blocks;}
+
+/*---------------------------------------------------------------------------*/
+
+typedef block_result_t::link_t      link_t;
+typedef std::vector<link_t>         link_list_t;
+
+inline cellid_t foreign_link(cellid_t c) {return -(c+1);}
+
+/*---------------------------------------------------------------------------*/
+
+void partition_t::work_block(int b,block_result_t &res) const
+{
+  const uint T = m_mesh.num_tris(),tb = block_begin(b),te = block_begin(b+1);
+
+  // Grow the ghost rings. A vertex gets the ring in which it is first
+  // reached, with 0 for the verts of the block's own tris. Ring r+1 is
+  // reached through the stars of the ring r verts, and the block's tris
+  // are the stars of all verts in rings 0 .. num_rings-1.
+  boost::unordered_map<uint,int> vring;
+  std::vector<uint>              front,next,gtris;
+
+  for(uint t = tb ; t < te; ++t)
+    for(int k = 0 ; k < 3; ++k)
+      if(vring.insert(make_pair(m_mesh.tri(t)[k],0)).second)
+        front.push_back(m_mesh.tri(t)[k]);
+
+  for(int r = 0 ; r < m_num_rings; ++r)
+  {
+    next.clear();
+
+    for(int i = 0 ; i < front.size(); ++i)
+      for(uint j = 0 ; j < m_vtri.num_tris(front[i]); ++j)
+      {
+        uint        t  = m_vtri.tris(front[i])[j];
+        const uint *tv = m_mesh.tri(t);
+
+        gtris.push_back(t);
+
+        for(int k = 0 ; k < 3; ++k)
+          if(vring.insert(make_pair(tv[k],r+1)).second)
+            next.push_back(tv[k]);
+      }
+
+    front.swap(next);
+  }
+
+  std::sort(gtris.begin(),gtris.end());
+  gtris.erase(std::unique(gtris.begin(),gtris.end()),gtris.end());
+
+  // Local ids follow the global ids, so that all id based tie breaks in
+  // the gradient go the same way as they do in-core.
+  std::vector<uint> gverts;
+  gverts.reserve(vring.size());
+
+  for(BOOST_AUTO(it,vring.begin()); it != vring.end(); ++it)
+    gverts.push_back(it->first);
+
+  std::sort(gverts.begin(),gverts.end());
+
+  const int nv = gverts.size(),nt = gtris.size();
+
+  fn_list_t      lfns(nv);
+  tri_idx_list_t ltris(nt);
+  bool_list_t    vown(nv,false),town(nt,false);
+  std::vector<uint> vmintri(nv,T);
+
+  for(int v = 0 ; v < nv; ++v)
+    lfns[v] = m_mesh.fn(gverts[v]);
+
+  for(int t = 0 ; t < nt; ++t)
+  {
+    town[t] = is_in_range(gtris[t],tb,te);
+
+    for(int k = 0 ; k < 3; ++k)
+    {
+      int v = lower_bound(gverts.begin(),gverts.end(),m_mesh.tri(gtris[t])[k])
+          - gverts.begin();
+
+      ltris[t][k] = v;
+      vmintri[v]  = std::min(vmintri[v],gtris[t]);
+    }
+  }
+
+  // The whole star of a ring 0 vertex is local.
+  for(int v = 0 ; v < nv; ++v)
+    vown[v] = vring[gverts[v]] == 0 && is_in_range(vmintri[v],tb,te);
+
+  vring.clear();
+
+  tri_cc_ptr_t tcc(new tri_cc_t);
+  tcc->init(ltris,nv,false);
+
+  dataset_t ds(lfns,tcc);
+  ds.set_gradient(m_gradient);
+  ds.work_gradient();
+
+  const int ne = tcc->edge_ct(),tbias = nv + ne;
+
+  // edges are owned by the block of their lowest indexed cofacet and are
+  // keyed by their rank among the block's edges
+  cellid_list_t erank(ne,-1);
+  res.num_edges = 0;
+
+  for(int e = 0 ; e < ne; ++e)
+  {
+    cellid_t cf[2];
+    int      cf_ct = tcc->get_cell_co_facets(nv + e,cf);
+    uint     gt    = gtris[cf[0] - tbias];
+
+    if(cf_ct == 2)
+      gt = std::min(gt,gtris[cf[1] - tbias]);
+
+    if(is_in_range(gt,tb,te))
+      erank[e] = res.num_edges++;
+  }
+
+  // Follow a gradient path from an owned vertex (tri) down (up) to a
+  // minimum (maximum) or to the first cell that another block owns.
+  struct chain_t
+  {
+    const dataset_t &ds; const tri_cc_t &tcc;
+    const bool_list_t &vown,&town;
+    const std::vector<uint> &gverts,&gtris;
+    int tbias;
+
+    cellid_t vert(cellid_t v) const
+    {
+      while(true)
+      {
+        if(!vown[v])         return foreign_link(gverts[v]);
+        if(ds.is_critical(v)) return gverts[v];
+        v = tcc.get_opp_cell(v,ds.pair(v));
+      }
+    }
+
+    cellid_t tri(cellid_t t) const
+    {
+      while(true)
+      {
+        if(!town[t - tbias])  return foreign_link(gtris[t - tbias]);
+        if(ds.is_critical(t)) return gtris[t - tbias];
+
+        cellid_t cf[2];
+        ENSURE(tcc.get_cell_co_facets(ds.pair(t),cf) == 2,
+               "tri paired to a boundary edge");
+        t = (cf[0] == t)?(cf[1]):(cf[0]);
+      }
+    }
+  } chain = {ds,*tcc,vown,town,gverts,gtris,tbias};
+
+  for(BOOST_AUTO(c,tcc->begin()); c != tcc->end(); ++c)
+  {
+    if(!ds.is_critical(*c))
+      continue;
+
+    block_result_t::cp_t cp;
+
+    cp.index = ds.cell_dim(*c);
+
+    switch(cp.index)
+    {
+    case 0: if(!vown[*c])            continue; cp.key = gverts[*c];       break;
+    case 1: if(erank[*c - nv] == -1) continue; cp.key = erank[*c - nv];   break;
+    case 2: if(!town[*c - tbias])    continue; cp.key = gtris[*c - tbias];break;
+    }
+
+    cp.is_bnd = ds.is_boundry(*c);
+    cp.fn     = ds.fn<dataset_t::CFI_MAX>(*c);
+    cp.vertid = gverts[ds.max_vert<-1>(*c)];
+    cp.nasc   = 0;
+
+    if(cp.index == 1)
+    {
+      cellid_t f[2];
+
+      ds.get_cets<DES>(*c,f);
+      cp.des[0] = chain.vert(f[0]);
+      cp.des[1] = chain.vert(f[1]);
+
+      cp.nasc = ds.get_cets<ASC>(*c,f);
+      for(int i = 0 ; i < cp.nasc; ++i)
+        cp.asc[i] = chain.tri(f[i]);
+    }
+
+    res.cps.push_back(cp);
+  }
+
+  // Another block's paths may enter this one at an owned vertex (tri) that
+  // shares a tri (edge) with a cell that this block does not own.
+  bool_list_t vlnk(nv,false);
+
+  for(int t = 0 ; t < nt; ++t)
+  {
+    bool is_lnk = !town[t];
+
+    for(int k = 0 ; k < 3; ++k)
+      is_lnk |= !vown[ltris[t][k]];
+
+    for(int k = 0 ; is_lnk && k < 3; ++k)
+      vlnk[ltris[t][k]] = true;
+  }
+
+  for(int v = 0 ; v < nv; ++v)
+    if(vown[v] && vlnk[v])
+      res.vlinks.push_back(link_t(gverts[v],chain.vert(v)));
+
+  for(int t = 0 ; t < nt; ++t)
+  {
+    if(!town[t])
+      continue;
+
+    cellid_t e[3],cf[2];
+    tcc->get_cell_facets(tbias + t,e);
+
+    bool is_lnk = false;
+
+    for(int k = 0 ; k < 3; ++k)
+      if(tcc->get_cell_co_facets(e[k],cf) == 2)
+        is_lnk |= !town[cf[0] - tbias] || !town[cf[1] - tbias];
+
+    if(is_lnk)
+      res.tlinks.push_back(link_t(gtris[t],chain.tri(tbias + t)));
+  }
+
+  std::sort(res.vlinks.begin(),res.vlinks.end());
+  std::sort(res.tlinks.begin(),res.tlinks.end());
+}
+
+/*---------------------------------------------------------------------------*/
+
+inline cellid_t resolve_link(const link_list_t &links,cellid_t l)
+{
+  // a path crosses each link at most once, unless the blocks disagree
+  for(int i = 0 ; l < 0; ++i)
+  {
+    ENSURE(i <= links.size(),"cyclic block links.. too few ghost rings?");
+
+    cellid_t c = -l-1;
+
+    BOOST_AUTO(it,lower_bound(links.begin(),links.end(),link_t(c,-INT_MAX)));
+
+    ENSUREV(it != links.end() && it->first == c,"unresolved block link",c);
+
+    l = it->second;
+  }
+
+  return l;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void partition_t::merge(const std::vector<block_result_t> &res,
+                        mscomplex_ptr_t msc) const
+{
+  ENSURE(res.size() == m_num_blocks,"need the results of all blocks");
+
+  const int V = m_mesh.num_verts();
+
+  int_list_t eoff(m_num_blocks);
+  int        E = 0;
+
+  for(int b = 0 ; b < m_num_blocks; ++b)
+  {
+    eoff[b] = E;
+    E      += res[b].num_edges;
+  }
+
+  // cps go in cellid order, as they do in-core
+  typedef std::pair<cellid_t,const block_result_t::cp_t*> gcp_t;
+
+  std::vector<gcp_t> cps;
+  link_list_t        vlinks,tlinks;
+
+  for(int b = 0 ; b < m_num_blocks; ++b)
+  {
+    for(int i = 0 ; i < res[b].cps.size(); ++i)
+    {
+      const block_result_t::cp_t &cp = res[b].cps[i];
+
+      cellid_t c = cp.key;
+
+      if(cp.index == 1) c += V + eoff[b];
+      if(cp.index == 2) c += V + E;
+
+      cps.push_back(gcp_t(c,&cp));
+    }
+
+    vlinks.insert(vlinks.end(),res[b].vlinks.begin(),res[b].vlinks.end());
+    tlinks.insert(tlinks.end(),res[b].tlinks.begin(),res[b].tlinks.end());
+  }
+
+  std::sort(cps.begin(),cps.end());
+  std::sort(vlinks.begin(),vlinks.end());
+  std::sort(tlinks.begin(),tlinks.end());
+
+  msc->resize(cps.size());
+
+  for(int i = 0 ; i < cps.size(); ++i)
+  {
+    const block_result_t::cp_t &cp = *cps[i].second;
+    msc->set_critpt(i,cps[i].first,cp.index,cp.fn,cp.vertid,cp.is_bnd);
+  }
+
+  for(int i = 0 ; i < cps.size(); ++i)
+  {
+    const block_result_t::cp_t &cp = *cps[i].second;
+
+    if(cp.index != 1)
+      continue;
+
+    cellid_t ex[4]; int ex_ct = 0;
+
+    ex[ex_ct++] = resolve_link(vlinks,cp.des[0]);
+    ex[ex_ct++] = resolve_link(vlinks,cp.des[1]);
+
+    for(int j = 0 ; j < cp.nasc; ++j)
+      ex[ex_ct++] = V + E + resolve_link(tlinks,cp.asc[j]);
+
+    for(int j = 0 ; j < ex_ct; ++j)
+    {
+      BOOST_AUTO(it,lower_bound(cps.begin(),cps.end(),gcp_t(ex[j],0)));
+
+      ENSUREV(it != cps.end() && it->first == ex[j],"missing extremum",ex[j]);
+
+      msc->connect_cps(i,it - cps.begin());
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void partition_t::work(mscomplex_ptr_t msc) const
+{
+  std::vector<block_result_t> res(m_num_blocks);
+
+#pragma omp parallel for schedule(dynamic,1)
+  for(int b = 0 ; b < m_num_blocks; ++b)
+    work_block(b,res[b]);
+
+  merge(res,msc);
+}
+
+/*---------------------------------------------------------------------------*/
+
+inline bool write_all(int fd,const char *p,size_t n)
+{
+  while(n > 0)
+  {
+    ssize_t r = write(fd,p,n);
+
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) return false;
+
+    p += r; n -= r;
+  }
+  return true;
+}
+
+inline bool read_all(int fd,char *p,size_t n)
+{
+  while(n > 0)
+  {
+    ssize_t r = read(fd,p,n);
+
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) return false;
+
+    p += r; n -= r;
+  }
+  return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void partition_t::work_procs(mscomplex_ptr_t msc,int num_procs) const
+{
+  ENSUREV(num_procs > 0,"need at least one process",num_procs);
+
+  num_procs = std::min(num_procs,m_num_blocks);
+
+  // Worker w works blocks w, w + num_procs, ... and sends each result as
+  // a size prefixed archive as soon as it is done, so that it holds only
+  // one block at a time. Workers don't depend on each other, so reading
+  // their pipes one after another cannot deadlock.
+  std::vector<pid_t> pids(num_procs);
+  std::vector<int>   fds(num_procs);
+
+  for(int w = 0 ; w < num_procs; ++w)
+  {
+    int pfd[2];
+
+    ENSURE(pipe(pfd) == 0,"unable to create pipe");
+
+    pids[w] = fork();
+
+    ENSURE(pids[w] != -1,"unable to fork worker");
+
+    if(pids[w] == 0)
+    {
+      close(pfd[0]);
+
+      for(int i = 0 ; i < w; ++i)
+        close(fds[i]);
+
+      utl::set_num_threads(1);
+
+      bool is_ok = true;
+
+      try
+      {
+        for(int b = w ; is_ok && b < m_num_blocks; b += num_procs)
+        {
+          block_result_t res;
+          work_block(b,res);
+
+          std::ostringstream os;
+          res.save_bin(os);
+
+          std::string buf  = os.str();
+          uint64_t    size = buf.size();
+
+          is_ok = write_all(pfd[1],(const char*)&size,sizeof(size)) &&
+                  write_all(pfd[1],buf.data(),buf.size());
+        }
+      }
+      catch(std::exception &e)
+      {
+        std::cerr<<e.what()<<std::endl;
+        is_ok = false;
+      }
+
+      close(pfd[1]);
+      _exit(is_ok?(0):(1));
+    }
+
+    close(pfd[1]);
+    fds[w] = pfd[0];
+  }
+
+  std::vector<block_result_t> res(m_num_blocks);
+
+  bool is_ok = true;
+
+  for(int w = 0 ; w < num_procs; ++w)
+  {
+    for(int b = w ; is_ok && b < m_num_blocks; b += num_procs)
+    {
+      uint64_t    size;
+      std::string buf;
+
+      is_ok = read_all(fds[w],(char*)&size,sizeof(size));
+
+      if(is_ok)
+      {
+        buf.resize(size);
+        is_ok = read_all(fds[w],&buf[0],size);
+      }
+
+      if(is_ok)
+      {
+        std::istringstream is(buf);
+        res[b].load_bin(is);
+      }
+    }
+
+    close(fds[w]);
+
+    int status;
+
+    if(waitpid(pids[w],&status,0) != pids[w] ||
+       !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      is_ok = false;
+  }
+
+  ENSURE(is_ok,"a block worker process failed");
+
+  merge(res,msc);
+}
+
+/*---------------------------------------------------------------------------*/
+
+template<class Archive>
+void block_result_t::cp_t::serialize(Archive & ar, const unsigned int version)
+{
+  ar& BOOST_SERIALIZATION_NVP(key);
+  ar& BOOST_SERIALIZATION_NVP(index);
+  ar& BOOST_SERIALIZATION_NVP(is_bnd);
+  ar& BOOST_SERIALIZATION_NVP(fn);
+  ar& BOOST_SERIALIZATION_NVP(vertid);
+  ar& BOOST_SERIALIZATION_NVP(des);
+  ar& BOOST_SERIALIZATION_NVP(asc);
+  ar& BOOST_SERIALIZATION_NVP(nasc);
+}
+
+/*---------------------------------------------------------------------------*/
+
+template<class Archive>
+void block_result_t::serialize(Archive & ar, const unsigned int version)
+{
+  ar& BOOST_SERIALIZATION_NVP(num_edges);
+  ar& BOOST_SERIALIZATION_NVP(cps);
+  ar& BOOST_SERIALIZATION_NVP(vlinks);
+  ar& BOOST_SERIALIZATION_NVP(tlinks);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void block_result_t::save_bin(std::ostream &os) const
+{
+  boost::archive::binary_oarchive oa(os);
+  oa << BOOST_SERIALIZATION_NVP(*this);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void block_result_t::load_bin(std::istream &is)
+{
+  boost::archive::binary_iarchive ia(is);
+  ia >> BOOST_SERIALIZATION_NVP(*this);
+}
+
+/*===========================================================================*/
+
+}
@@ -0,0 +1,104 @@
+#ifndef TRIMESH_PARTITION_H_INCLUDED
+#define TRIMESH_PARTITION_H_INCLUDED
+
+#include <trimesh.h>
+#include <trimesh_dataset.h>
+#include <trimesh_io.h>
+
+namespace trimesh
+{
+  /// \brief What one block of a partitioned mesh contributes to the msc
+  ///
+  /// \note  Gradient paths that leave a block are recorded as links. A link
+  ///        value v >= 0 is the extremum (vertex or tri id) the path ends
+  ///        at. v < 0 means that the path continues at the cell -v-1 owned
+  ///        by another block, whose links are then followed.
+  struct block_result_t
+  {
+    /// \brief A critical cell owned by the block
+    struct cp_t
+    {
+      cellid_t key;    // vertex id, rank among the block's edges or tri id
+      char     index;
+      bool     is_bnd;
+      fn_t     fn;
+      cellid_t vertid;
+      cellid_t des[2]; // saddles : links from the two verts
+      cellid_t asc[2]; // saddles : links from the one or two tris
+      char     nasc;
+
+      template<class Archive>
+      void serialize(Archive & ar, const unsigned int version);
+    };
+
+    typedef std::pair<cellid_t,cellid_t> link_t;
+
+    int                 num_edges;  // edges owned by the block
+    std::vector<cp_t>   cps;
+    std::vector<link_t> vlinks;     // block interface verts -> link
+    std::vector<link_t> tlinks;     // block interface tris  -> link
+
+    void save_bin(std::ostream &os) const;
+    void load_bin(std::istream &is);
+
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version);
+  };
+
+  /// \brief Computes the MS complex of a mesh one block of tris at a time
+  ///
+  /// \note  The tris are split into contiguous index ranges. A block's cells
+  ///        are the tris in its range and the verts/edges whose lowest
+  ///        indexed tri is in its range. Each block computes its gradient
+  ///        on its tris plus num_rings rings of ghost tris, so the pairs of
+  ///        the cells it owns match the in-core gradient. The gradient paths
+  ///        are then stitched across blocks, giving the same mscomplex_t as
+  ///        dataset_t::work. Manifolds are not collected.
+  ///
+  /// \note  An owned edge of the passes gradient may be paired through the
+  ///        pair of a ring 1 vert, and that pair needs the vert's whole star.
+  ///        So the passes gradient needs two rings. The lower star gradient
+  ///        pairs a cell within the star of its max vert, which is a ring 0
+  ///        vert for owned cells, so one ring will do. Fewer are rejected.
+  ///
+  /// \note  Peak memory is that of one block and its ghosts per thread, plus
+  ///        the critical points and the block interface links. The ghost
+  ///        rings are grown through the mesh's vert to tri index file, which
+  ///        is mmapped like the mesh itself (see mesh_vtri_view_t).
+  class partition_t
+  {
+  public:
+    partition_t(const mesh_bin_view_t &mesh,int num_blocks,int num_rings=3,
+                dataset_t::eGradient grad = dataset_t::GRAD_PASSES);
+
+    inline int num_blocks() const {return m_num_blocks;}
+
+    /// \brief Fewest ghost rings for which blocks match the in-core gradient
+    static int min_rings(dataset_t::eGradient grad);
+
+    /// \brief Compute the gradient of block b and what it contributes
+    void work_block(int b,block_result_t &res) const;
+
+    /// \brief Stitch the results of all blocks into msc
+    void merge(const std::vector<block_result_t> &res,mscomplex_ptr_t msc) const;
+
+    /// \brief Work all blocks in this process and merge them into msc
+    void work(mscomplex_ptr_t msc) const;
+
+    /// \brief Work the blocks in num_procs forked worker processes, which
+    ///        send their results back over pipes, and merge them into msc
+    /// \note  Call this before any openmp region has run in this process.
+    void work_procs(mscomplex_ptr_t msc,int num_procs) const;
+
+  private:
+    inline uint block_begin(int b) const;
+
+    const mesh_bin_view_t &m_mesh;
+    int                    m_num_blocks;
+    int                    m_num_rings;
+    dataset_t::eGradient   m_gradient;
+    mesh_vtri_view_t       m_vtri;
+  };
+}
+
+#endif
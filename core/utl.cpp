@@ -7,6 +7,10 @@
 
 #include <tr1/functional>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 /*===========================================================================*/
 
@@ -85,6 +89,27 @@ const std::string & file_line_iterator::dereference() const
 
 /*---------------------------------------------------------------------------*/
 
+void set_num_threads(int n)
+{
+#ifdef _OPENMP
+  if(n <= 0) n = omp_get_num_procs();
+  omp_set_num_threads(n);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+int get_num_threads()
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
 boost::mutex logger::s_mutex;
 logger       logger::s_logger;
 
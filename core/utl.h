@@ -106,6 +106,11 @@ namespace la
 /* Misc utility functions
 /*---------------------------------------------------------------------------*/
 
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
 namespace utl {
 
 /*---------------------------------------------------------------------------*/
@@ -117,6 +122,9 @@ inline std::string to_string (const T& v)
 
 /*---------------------------------------------------------------------------*/
 
+/// \brief idxs = the indices of [b,e) in ascending order of their values.
+///        Equal values are in index order.
+/// \note  Chunks are sorted in parallel and then merged pairwise.
 template <class iter_t>
 void argsort(iter_t b, iter_t e, std::vector<size_t>& idxs);
 
@@ -158,6 +166,58 @@ inline void from_string(std::string s,T1& t1,T2& t2,T3& t3,T4& t4)
 
 /*---------------------------------------------------------------------------*/
 
+/// \brief Set the number of threads used by the parallel stages
+/// \note  n <= 0 means use all available cores
+void set_num_threads(int n);
+
+/// \brief Number of threads used by the parallel stages
+int get_num_threads();
+
+/*---------------------------------------------------------------------------*/
+
+template <class iter_t>
+struct argsort_lt_t
+{
+  iter_t b;
+  argsort_lt_t(iter_t b_):b(b_){}
+
+  inline bool operator()(size_t i,size_t j) const
+  {return (b[i] < b[j]) || (!(b[j] < b[i]) && i < j);}
+};
+
+template <class iter_t>
+void argsort(iter_t b, iter_t e, std::vector<size_t>& idxs)
+{
+  int n = e - b;
+  int k = std::max(1,std::min(get_num_threads(),n/4096));
+
+  idxs.resize(n);
+
+  for(int i = 0 ; i < n; ++i)
+    idxs[i] = i;
+
+  argsort_lt_t<iter_t> lt(b);
+
+  std::vector<int> cb(k+1);
+
+  for(int i = 0 ; i <= k; ++i)
+    cb[i] = (long(n)*i)/k;
+
+#pragma omp parallel for schedule(static,1)
+  for(int i = 0 ; i < k; ++i)
+    std::sort(idxs.begin()+cb[i],idxs.begin()+cb[i+1],lt);
+
+  for(int w = 1 ; w < k; w *= 2)
+  {
+#pragma omp parallel for schedule(static,1)
+    for(int i = 0 ; i < k - w; i += 2*w)
+      std::inplace_merge(idxs.begin()+cb[i],idxs.begin()+cb[i+w],
+                         idxs.begin()+cb[std::min(i+2*w,k)],lt);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
 }// namespace utl
 /*===========================================================================*/
 
@@ -236,6 +296,15 @@ class timer
     return double(td.total_milliseconds())/1000;
   }
 
+  /// \brief elapsed time in microseconds, for stages too short for elapsed
+  inline long   elapsed_us() const
+  {
+    boost::posix_time::time_duration td =
+        boost::posix_time::microsec_clock::local_time() - _start_time;
+
+    return td.total_microseconds();
+  }
+
  private:
   boost::posix_time::ptime _start_time;
 }; // timer
@@ -35,7 +35,7 @@ for cp in msc.cps():
 # Write the combinatorial adjaceny list of each cp
 fo.write("#  id  NumAdj adjCp1 adjCp2 ..\n")
 for cp in msc.cps():
-	conn = list(msc.asc(cp)) + msc.des(cp)
+	conn = list(msc.asc(cp)) + list(msc.des(cp))
 	
 	ln  = ""
 	ln += str(cp).ljust(10)
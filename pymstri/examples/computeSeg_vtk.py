@@ -17,8 +17,9 @@ msc.compute_off("3wde.off")
 # simplify using persistence upto 5% of the function range
 msc.simplify_pers(0.05,True,0,0)
 
-# collect the msc geometry after simplification
-msc.collect_geom()
+# only the des geometry of the maxima is needed. So rather than collect all
+# the msc geometry, have it traversed for each cp when it is asked for.
+msc.set_lazy_geom()
 
 # get the object representing the triangulation. 
 tcc = msc.get_tri_cc()
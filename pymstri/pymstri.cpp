@@ -1,4 +1,5 @@
 #include <boost/python.hpp>
+#include <boost/python/numpy.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
@@ -16,6 +17,7 @@ using namespace trimesh;
 using namespace utl;
 
 namespace bp = boost::python;
+namespace np = boost::python::numpy;
 
 
 /*****************************************************************************/
@@ -84,6 +86,109 @@ void read_off(const std::string &fname,
 }
 
 
+/*****************************************************************************/
+/******** NumPy arrays in and out                                     ********/
+/*****************************************************************************/
+
+/// \brief A C contiguous nd array of T over a (any object that numpy can
+///        make an array of). a is used as is if it already is one.
+template<typename T>
+np::ndarray as_array(bp::object a,int nd,int ncols=0)
+{
+  np::dtype   dt = np::dtype::get_builtin<T>();
+  np::ndarray r  = np::from_object(a,nd,nd);
+
+  // numpy only casts safely here.. so int64 tris etc are cast by hand
+  if(!np::equivalent(r.get_dtype(),dt))
+    r = r.astype(dt);
+
+  r = np::from_object(r,dt,nd,nd,np::ndarray::C_CONTIGUOUS);
+
+  ENSURES(nd == 1 || r.shape(1) == ncols)
+      << "Expected an array of shape (n,"<<ncols<<")\n";
+
+  return r;
+}
+
+/// \brief A read only 1d array over the n T's at p. The memory is not
+///        copied.. owner is kept alive for as long as the array is.
+template<typename T>
+np::ndarray share_array(const T *p,size_t n,bp::object owner)
+{
+  return np::from_data(p,np::dtype::get_builtin<T>(),bp::make_tuple(n),
+                       bp::make_tuple(sizeof(T)),owner);
+}
+
+template<typename T>
+void delete_list(PyObject *c)
+{
+  delete (std::vector<T>*)PyCapsule_GetPointer(c,0);
+}
+
+/// \brief A 1d array that takes over the contents of l
+template<typename T>
+np::ndarray own_array(std::vector<T> &l)
+{
+  std::vector<T> *h = new std::vector<T>;
+  h->swap(l);
+
+  bp::object owner(bp::handle<>(PyCapsule_New(h,0,&delete_list<T>)));
+
+  return np::from_data(h->data(),np::dtype::get_builtin<T>(),
+                       bp::make_tuple(h->size()),bp::make_tuple(sizeof(T)),
+                       owner);
+}
+
+/// \brief A 1d array with a copy of the n T's at p
+template<typename T>
+np::ndarray copy_array(const T *p,size_t n)
+{
+  std::vector<T> l(p,p+n);
+  return own_array(l);
+}
+
+/// \brief verts (n,3) and tris (m,3) arrays to the lists that
+///        tri_cc_geom_t::init takes
+void read_arrays(bp::object verts_obj,bp::object tris_obj,
+                 tri_cc_geom_t::vertex_list_t &verts,
+                 tri_cc_geom_t::tri_idx_list_t &tris)
+{
+  np::ndarray va = as_array<double>(verts_obj,2,3);
+  np::ndarray ta = as_array<int>(tris_obj,2,3);
+
+  int nv = va.shape(0), nt = ta.shape(0);
+
+  const double *v = (const double*)(const void*)va.get_data();
+  const int    *t = (const int*)(const void*)ta.get_data();
+
+  verts.resize(nv);
+  tris.resize(nt);
+
+  for(int i = 0 ; i < nv; ++i)
+    verts[i] = la::make_vec<double>(v[3*i],v[3*i+1],v[3*i+2]);
+
+  for(int i = 0 ; i < nt; ++i)
+  {
+    for(int j = 0 ; j < 3; ++j)
+      ENSURES(is_in_range(t[3*i+j],0,nv)) << "Invalid vert in tri "<< i <<"\n";
+
+    tris[i] = la::make_vec<uint>(t[3*i],t[3*i+1],t[3*i+2]);
+  }
+}
+
+/// \brief fn array of nv values to the list that dataset_t takes
+void read_fn_array(bp::object fn_obj,int nv,fn_list_t &fns)
+{
+  np::ndarray fa = as_array<fn_t>(fn_obj,1);
+
+  ENSURES(fa.shape(0) == nv)
+      << "Expected "<< nv <<" function values got "<< fa.shape(0) <<"\n";
+
+  const fn_t *f = (const fn_t*)(const void*)fa.get_data();
+
+  fns.assign(f,f+nv);
+}
+
 /*****************************************************************************/
 /******** Python wrapped Morse-Smale complex class                    ********/
 /*****************************************************************************/
@@ -94,6 +199,13 @@ class mscomplex_pymstri_t: public mscomplex_t
 public:
   tri_cc_geom_ptr_t tcc;
   dataset_ptr_t     ds;
+  fn_list_t         fns; // ds only holds a reference
+
+  boost::shared_ptr<mfold_cache_t> cache;
+
+  dataset_t::eGradient grad; // engine used by the compute functions
+
+  mscomplex_pymstri_t():grad(dataset_t::GRAD_PASSES){}
 };
 
 typedef  boost::shared_ptr<mscomplex_pymstri_t> mscomplex_pymstri_ptr_t;
@@ -110,6 +222,11 @@ tri_cc_geom_ptr_t mscomplex_get_tri_cc(mscomplex_pymstri_ptr_t msc)
   return msc->tcc;
 }
 
+void mscomplex_set_gradient(mscomplex_pymstri_ptr_t msc,std::string grad)
+{
+  msc->grad = dataset_t::gradient_from_string(grad);
+}
+
 void __mscomplex_compute_internel__(
     mscomplex_pymstri_ptr_t msc,
     tri_idx_list_t &tris,
@@ -122,7 +239,9 @@ void __mscomplex_compute_internel__(
   verts.clear();
   tris.clear();
 
-  msc->ds.reset(new dataset_t(func,msc->tcc->get_tri_cc()));
+  msc->fns.swap(func);
+  msc->ds.reset(new dataset_t(msc->fns,msc->tcc->get_tri_cc()));
+  msc->ds->set_gradient(msc->grad);
   msc->ds->work(msc);
 }
 
@@ -169,6 +288,83 @@ void mscomplex_compute_off_bin
 }
 
 
+void mscomplex_compute_tcc_bin
+(mscomplex_pymstri_ptr_t msc,tri_cc_geom_ptr_t tcc,
+ std::string bin_file,std::string bin_fmt="float64")
+{
+  int nv = tcc->get_tri_cc()->vert_ct();
+
+  if(bin_fmt == "float32")
+    read_bin_arr<float>(bin_file,msc->fns,nv);
+  else if(bin_fmt == "float64")
+    read_bin_arr<double>(bin_file,msc->fns,nv);
+  else
+    throw std::runtime_error("Unknown bin format");
+
+  msc->tcc = tcc;
+  msc->ds.reset(new dataset_t(msc->fns,tcc->get_tri_cc()));
+  msc->ds->set_gradient(msc->grad);
+  msc->ds->work(msc);
+}
+
+
+void mscomplex_compute_arrays
+(mscomplex_pymstri_ptr_t msc,bp::object verts_obj,bp::object tris_obj,
+ bp::object fn_obj)
+{
+  tri_idx_list_t tris;
+  tri_cc_geom_t::vertex_list_t  verts;
+  fn_list_t funcs;
+
+  read_arrays(verts_obj,tris_obj,verts,tris);
+  read_fn_array(fn_obj,verts.size(),funcs);
+
+  __mscomplex_compute_internel__(msc,tris,verts,funcs);
+}
+
+void mscomplex_compute_tcc_array
+(mscomplex_pymstri_ptr_t msc,tri_cc_geom_ptr_t tcc,bp::object fn_obj)
+{
+  read_fn_array(fn_obj,tcc->get_tri_cc()->vert_ct(),msc->fns);
+
+  msc->tcc = tcc;
+  msc->ds.reset(new dataset_t(msc->fns,tcc->get_tri_cc()));
+  msc->ds->set_gradient(msc->grad);
+  msc->ds->work(msc);
+}
+
+void mscomplex_update
+(mscomplex_pymstri_ptr_t msc,bp::object verts_obj,bp::object fn_obj)
+{
+  ENSURES(msc->ds != 0)
+      << "update needs a complex computed in this session\n";
+
+  ENSURES(msc->ds->get_gradient() == dataset_t::GRAD_PASSES)
+      << "update is only done for the passes gradient\n";
+
+  np::ndarray va = as_array<int>(verts_obj,1);
+
+  int nv = va.shape(0);
+
+  fn_list_t fns;
+  read_fn_array(fn_obj,nv,fns);
+
+  const int *v = (const int*)(const void*)va.get_data();
+
+  for(int i = 0 ; i < nv; ++i)
+    ENSURES(is_in_range(v[i],0,msc->fns.size()))
+        << "Invalid vertex "<< v[i] <<"\n";
+
+  for(int i = 0 ; i < nv; ++i)
+    msc->fns[v[i]] = fns[i];
+
+  msc->ds->update(cellid_list_t(v,v+nv),msc);
+
+  // cached manifolds are those of the old gradient
+  if(msc->cache)
+    msc->cache.reset(new mfold_cache_t(msc,msc->ds,msc->cache->max_cells()));
+}
+
 int mscomplex_num_canc(mscomplex_pymstri_ptr_t msc)
 {
   return msc->m_canc_list.size();
@@ -186,25 +382,36 @@ bp::tuple mscomplex_frange(mscomplex_pymstri_ptr_t msc)
 }
 
 template <eGDIR dir>
-bp::list mscomplex_conn(mscomplex_pymstri_ptr_t msc, int i)
+np::ndarray mscomplex_conn(mscomplex_pymstri_ptr_t msc, int i)
 {
   ASSERT(is_in_range(i,0,msc->get_num_critpts()));
-  bp::list r;
-  BOOST_FOREACH(int c,msc->m_conn[dir][i])
-  {
-    r.append(c);
-  }
-  return r;
+  int_list_t r(msc->m_conn[dir][i].begin(),msc->m_conn[dir][i].end());
+  return own_array(r);
 }
 
-bp::list mscomplex_cps(mscomplex_pymstri_ptr_t msc)
+np::ndarray mscomplex_cps(mscomplex_pymstri_ptr_t msc)
 {
-  bp::list r;
+  int_list_t r;
 
   for(int i = 0 ; i < msc->get_num_critpts(); ++i)
     if(msc->is_not_paired(i))
-      r.append(i);
+      r.push_back(i);
 
+  return own_array(r);
+}
+
+bp::dict mscomplex_cp_table(mscomplex_pymstri_ptr_t msc)
+{
+  // the cp lists are reallocated by compute, load etc.. so they are copied
+  int n = msc->get_num_critpts();
+
+  bp::dict r;
+  r["cellid"]     = copy_array(msc->m_cp_cellid.data(),n);
+  r["vertid"]     = copy_array(msc->m_cp_vertid.data(),n);
+  r["pair_idx"]   = copy_array(msc->m_cp_pair_idx.data(),n);
+  r["index"]      = copy_array((const int8_t*)msc->m_cp_index.data(),n);
+  r["is_boundry"] = copy_array((const int8_t*)msc->m_cp_is_boundry.data(),n);
+  r["fn"]         = copy_array(msc->m_cp_fn.data(),n);
   return r;
 }
 
@@ -219,21 +426,78 @@ void mscomplex_collect_mfolds(mscomplex_pymstri_ptr_t msc)
 {
   ENSURES(msc->ds !=0)
       << "Gradient information unavailable" <<endl
-      << "Did you load the mscomplex from a file!!!"<<endl;
+      << "Did you load the mscomplex from a file!!! "
+      << "If it was saved with its gradient, call load_gradient"<<endl;
 
   msc->collect_mfolds(msc->ds);
 }
 
+void mscomplex_save_msc
+(mscomplex_pymstri_ptr_t msc,std::string f,bool compress_mfolds,
+ bool save_gradient)
+{
+  ENSURES(!save_gradient || msc->ds != 0)
+      << "Gradient information unavailable" <<endl;
+
+  msc->save_msc(f,compress_mfolds,(save_gradient)?(msc->ds):(dataset_ptr_t()));
+}
+
+void mscomplex_load_gradient
+(mscomplex_pymstri_ptr_t msc,tri_cc_geom_ptr_t tcc,std::string f)
+{
+  mscomplex_view_t v(f);
+
+  ENSURES(v.has_gradient())
+      << "No gradient in file=" << f <<endl
+      << "Save it with save_msc(f,save_gradient=True)"<<endl;
+
+  // only the gradient is read.. so no fns are needed
+  msc->fns.clear();
+  msc->tcc = tcc;
+  msc->ds.reset(new dataset_t(msc->fns,tcc->get_tri_cc()));
+  msc->cache.reset();
+
+  v.load_gradient(*msc->ds);
+}
+
+void mscomplex_set_lazy_geom(mscomplex_pymstri_ptr_t msc,size_t max_cells)
+{
+  ENSURES(msc->ds !=0)
+      << "Gradient information unavailable" <<endl
+      << "Did you load the mscomplex from a file!!! "
+      << "If it was saved with its gradient, call load_gradient"<<endl;
+
+  msc->cache.reset(new mfold_cache_t(msc,msc->ds,max_cells));
+}
+
 template <eGDIR dir>
-bp::list mscomplex_geom(mscomplex_pymstri_ptr_t msc, int i)
+np::ndarray mscomplex_geom(mscomplex_pymstri_ptr_t msc, int i)
 {
   ASSERT(is_in_range(i,0,msc->get_num_critpts()));
-  bp::list r;
-  BOOST_FOREACH(int c,msc->m_mfolds[dir][i])
+
+  // cached manifolds may be evicted by the next call and collected ones
+  // are freed by the next collect_geom, compute or load.. so both are copied
+  if(msc->cache)
   {
-    r.append(c);
+    mfold_t m = msc->cache->get(dir,i);
+    return own_array(m);
   }
-  return r;
+
+  const mfold_t &m = msc->m_mfolds[dir][i];
+  return copy_array(m.data(),m.size());
+}
+
+template <eGDIR dir>
+np::ndarray mscomplex_labels(mscomplex_pymstri_ptr_t msc, int dim)
+{
+  ENSURES(msc->ds !=0)
+      << "Gradient information unavailable" <<endl
+      << "Did you load the mscomplex from a file!!! "
+      << "If it was saved with its gradient, call load_gradient"<<endl;
+
+  int_list_t labels;
+  msc->get_mfold_labels(dir,dim,msc->ds,labels);
+  return own_array(labels);
 }
 
 //bp::list mscomplex_arc_geom(mscomplex_ptr_t msc, int a, int b)
@@ -280,6 +544,24 @@ void wrap_mscomplex_t()
            "Load mscomplex from file")
       .def("save",&mscomplex_t::save,
            "Save mscomplex to file")
+      .def("save_msc",&mscomplex_save_msc,
+           (bp::arg("f"),bp::arg("compress_mfolds")=false,
+            bp::arg("save_gradient")=false),
+           "Save mscomplex to file in the sectioned format that\n"\
+           "mscomplex_view can open without reading the whole file\n"\
+           "Parameters:\n"\
+           "    f: file name\n"\
+           "    compress_mfolds: delta varint code the manifolds\n"\
+           "    save_gradient: also save the gradient (see load_gradient)")
+      .def("load_gradient",&mscomplex_load_gradient,
+           (bp::arg("tcc"),bp::arg("f")),
+           "Read the gradient saved in an msc file, so that collect_geom,\n"\
+           "set_lazy_geom and the labels work on a loaded complex\n"\
+           "without computing it again.\n"\
+           "Parameters:\n"\
+           "    tcc: the triangulation the complex was computed on, with\n"\
+           "         its tris in the same order.\n"\
+           "    f: msc file written by save_msc(f,save_gradient=True)")
       .def("num_canc",&mscomplex_num_canc,
            "Number of cancellation pairs")
       .def("canc",&mscomplex_canc,
@@ -287,19 +569,50 @@ void wrap_mscomplex_t()
       .def("frange",&mscomplex_frange,
            "Range of function values")
       .def("asc",&mscomplex_conn<ASC>,
-           "List of ascending cps connected to a given critical point i")
+           "int32 array of ascending cps connected to a given critical point i")
       .def("des",&mscomplex_conn<DES>,
-           "List of descending cps connected to a given critical point i")
+           "int32 array of descending cps connected to a given critical point i")
       .def("asc_geom",&mscomplex_geom<ASC>,
-           "Ascending manifold geometry of a given critical point i")
+           "Ascending manifold geometry of a given critical point i\n"\
+           "\n"\
+           "Note: The int32 array is a copy of the collected geometry.\n"\
+           )
       .def("des_geom",&mscomplex_geom<DES>,
-           "Descending manifold geometry of a given critical point i")
+           "Descending manifold geometry of a given critical point i\n"\
+           "\n"\
+           "Note: The int32 array is a copy of the collected geometry.\n"\
+           )
+      .def("asc_labels",&mscomplex_labels<ASC>,
+           "int32 array with the label of every dim cell: the cp whose\n"\
+           "ascending manifold holds it, or -1. dim is 0 (minima) or 1 (saddles).\n"\
+           "\n"\
+           "Note: This must be called only after any of the compute functions are called. \n"\
+           )
+      .def("des_labels",&mscomplex_labels<DES>,
+           "int32 array with the label of every dim cell: the cp whose\n"\
+           "descending manifold holds it, or -1. dim is 2 (maxima) or 1 (saddles).\n"\
+           "\n"\
+           "Note: This must be called only after any of the compute functions are called. \n"\
+           )
       .def("cps",&mscomplex_cps,
-           "Returns a list of surviving critical cps")
+           "int32 array of the surviving critical cps")
+      .def("cp_table",&mscomplex_cp_table,
+           "dict of per cp arrays, indexed by cp: cellid, vertid, pair_idx,\n"\
+           "index, is_boundry and fn. The arrays are copies, so call it\n"\
+           "again to see pair_idx after further simplification.")
       .def("gen_pers_hierarchy",&mscomplex_gen_pers_pairs,
            "Generates the persistence hierarchy using topo simplification")
       .def("get_tri_cc",mscomplex_get_tri_cc,
            "Get the underlying triangulation object")
+      .def("set_gradient",&mscomplex_set_gradient,
+           "Choose how the compute functions build the discrete gradient\n"\
+           "\n"\
+           "Parameters: \n"\
+           "    grad: \"passes\" (default) or \"lower-star\".\n"\
+           "\n"\
+           "Note: Both give the same critical point counts. The cells they\n"\
+           "     pair, and so the complex, can differ.\n"
+           )
       .def("compute_off",&mscomplex_compute_off,
            "Compute the Mscomplex from a triagulation given in the .off format\n"\
            "\n"\
@@ -322,6 +635,70 @@ void wrap_mscomplex_t()
            "Note: This only computes the combinatorial structure\n"\
            "     Call collect_mfold(s) to extract geometry\n"
            )
+      .def("compute_arrays",&mscomplex_compute_arrays,
+           "Compute the Mscomplex from in memory arrays\n"\
+           "\n"\
+           "Parameters: \n"\
+           "    verts: (nv,3) array of vertex positions.\n"\
+           "    tris: (nt,3) array of vertex indices.\n"\
+           "    fn: (nv,) array of function values.\n"\
+           "\n"\
+           "Note: Any object that numpy can make an array of is taken. Arrays\n"\
+           "     of float64/int32 that are C contiguous are read in place.\n"\
+           "\n"\
+           "Note: This only computes the combinatorial structure\n"\
+           "     Call collect_mfold(s) to extract geometry\n"
+           )
+      .def("compute_tcc_array",&mscomplex_compute_tcc_array,
+           "Compute the Mscomplex of the function in the given array on an\n"\
+           "existing triangulation (see compute_tcc_bin).\n"\
+           "\n"\
+           "Parameters: \n"\
+           "    tcc: the triangulation (a tri_cc_geom or from get_tri_cc).\n"\
+           "    fn: (nv,) array of function values.\n"\
+           "\n"\
+           "Note: This only computes the combinatorial structure\n"\
+           "     Call collect_mfold(s) to extract geometry\n"
+           )
+      .def("update",&mscomplex_update,
+           "Recompute the complex after the function changed at a few verts.\n"\
+           "\n"\
+           "Parameters: \n"\
+           "    verts: (k,) int32 array of the changed verts.\n"\
+           "    fn: (k,) array of their new function values.\n"\
+           "\n"\
+           "Note: The gradient is only redone near the verts. Only the saddles\n"\
+           "      whose arcs changed are reconnected, and only the cancellations\n"\
+           "      around them are undone and redone, to the threshold of the\n"\
+           "      earlier simplify calls. Cps keep their numbers. Those of removed\n"\
+           "      cells are left paired to themselves and new ones may take their\n"\
+           "      place. The complex is left at its coarsest version and the\n"\
+           "      collected geometry is dropped, so call collect_geom again.\n"\
+           "      Only done for the passes gradient of a computed complex.\n"
+           )
+      .def("compute_tcc_bin",&mscomplex_compute_tcc_bin,
+           "Compute the Mscomplex of the scalar function in the given bin file\n"\
+           "on an existing triangulation. The triangulation is shared, not\n"\
+           "rebuilt, so a series of functions on one mesh (e.g. time steps)\n"\
+           "pays for its topology only once.\n"\
+           "\n"\
+           "Parameters: \n"\
+           "    tcc: the triangulation (a tri_cc_geom or from get_tri_cc).\n"\
+           "    bin_file: the bin file containing the scalar function.\n"\
+           "    bin_fmt: binary format .\n"\
+           "             Acceptable values = (\"float32\",\"float64\")\n"
+           "\n"\
+           "Note: This only computes the combinatorial structure\n"\
+           "     Call collect_mfold(s) to extract geometry\n"
+           )
+      .def("set_lazy_geom",&mscomplex_set_lazy_geom,
+           (bp::arg("max_cells")=size_t(1) << 24),
+           "Traverse the geometry of a cp only when asc_geom/des_geom ask\n"\
+           "for it, instead of all of it in collect_geom. The most recently\n"\
+           "used manifolds are kept, up to max_cells cells in all.\n"\
+           "\n"\
+           "Note: This must be called only after any of the compute functions are called. \n"\
+           )
       .def("collect_geom",&mscomplex_collect_mfolds,
            "Collect the geometry of all survivng critical points\n"\
            "\n"\
@@ -337,6 +714,25 @@ void wrap_mscomplex_t()
            "    req_nmax,req_nmin: num maxima/minima that should be retained\n"\
            "                       set to 0 to ignore"
            )
+      .def("get_multires_version",&mscomplex_t::get_multires_version,
+           "Number of cancellations applied to the complex")
+      .def("set_multires_version",&mscomplex_t::set_multires_version,
+           "Apply or undo cancellations till the given number are applied\n"\
+           "(see make_multires_checkpoints)")
+      .def("get_multires_version_for_thresh",
+           &mscomplex_t::get_multires_version_for_thresh,
+           (bp::arg("tresh"),bp::arg("is_nrm")=false),
+           "The version that simplify_pers(tresh,is_nrm) would give")
+      .def("make_multires_checkpoints",&mscomplex_t::make_multires_checkpoints,
+           (bp::arg("max_bytes")=size_t(1) << 28),
+           "Snapshot the connectivity at evenly spaced versions in at most\n"\
+           "max_bytes. set_multires_version then starts from the nearest\n"\
+           "snapshot below its target instead of undoing or redoing every\n"\
+           "cancellation in between.\n"\
+           "\n"\
+           "Note: Call it after gen_pers_hierarchy or simplify_pers. Later\n"\
+           "     simplification keeps the snapshots.\n"
+           )
 
 
 //      .def("arc_geom",&mscomplex_arc_geom,
@@ -361,6 +757,17 @@ tri_cc_geom_ptr_t tcc_from_off(std::string f)
   return ret;
 }
 
+tri_cc_geom_ptr_t tcc_from_arrays(bp::object verts_obj,bp::object tris_obj)
+{
+  tri_idx_list_t tris;
+  tri_cc_geom_t::vertex_list_t  verts;
+
+  read_arrays(verts_obj,tris_obj,verts,tris);
+  tri_cc_geom_ptr_t ret(new tri_cc_geom_t);
+  ret->init(tris,verts);
+  return ret;
+}
+
 inline bp::tuple dcell_range(tri_cc_geom_ptr_t tcc, int d)
 {
   ASSERT(is_in_range(d,0,3));
@@ -426,6 +833,8 @@ void wrap_tet_cc_t()
 
   class_<tri_cc_geom_t,tri_cc_geom_ptr_t >("tri_cc_geom",no_init)
       .def("__init__", make_constructor( &tcc_from_off) )
+      .def("__init__", make_constructor( &tcc_from_arrays),
+           "ctor.. takes an off file or verts (nv,3) and tris (nt,3) arrays")
       .def("num_dcells",&tri_cc_geom_t::get_num_cells_dim)
       .def("num_cells",&tri_cc_geom_t::get_num_cells)
       .def("dim",&tri_cc_geom_t::get_cell_dim)
@@ -438,18 +847,137 @@ void wrap_tet_cc_t()
 
 }
 
+/*****************************************************************************/
+/******** Python wrapped read only Morse-Smale complex file           ********/
+/*****************************************************************************/
+
+typedef boost::shared_ptr<mscomplex_view_t> mscomplex_view_ptr_t;
+
+mscomplex_view_ptr_t new_msc_view(std::string f)
+{
+  return mscomplex_view_ptr_t(new mscomplex_view_t(f));
+}
+
+template <eGDIR dir>
+np::ndarray msc_view_conn(mscomplex_view_ptr_t v, int i)
+{
+  ENSURES(is_in_range(i,0,v->get_num_critpts())) << "invalid cp "<< i <<"\n";
+  int_list_t r(v->conn(dir,i).begin(),v->conn(dir,i).end());
+  return own_array(r);
+}
+
+template <eGDIR dir>
+np::ndarray msc_view_geom(mscomplex_view_ptr_t v, int i)
+{
+  ENSURES(is_in_range(i,0,v->get_num_critpts())) << "invalid cp "<< i <<"\n";
+
+  // uncoded manifolds are read in place from the mapped file
+  if(!v->is_mfold_coded(dir))
+  {
+    mscomplex_view_t::mfold_range_t m = v->mfold(dir,i);
+    return share_array(m.begin(),m.size(),bp::object(v));
+  }
+
+  mfold_t m;
+  v->get_mfold(dir,i,m);
+  return own_array(m);
+}
+
+bp::dict msc_view_cp_table(mscomplex_view_ptr_t v)
+{
+  bp::object o(v);
+  int n = v->get_num_critpts();
+
+  bp::dict r;
+  r["cellid"]     = share_array(v->cp_cellid(),n,o);
+  r["vertid"]     = share_array(v->cp_vertid(),n,o);
+  r["pair_idx"]   = share_array(v->cp_pair_idx(),n,o);
+  r["index"]      = share_array((const int8_t*)v->cp_index(),n,o);
+  r["is_boundry"] = share_array((const int8_t*)v->cp_is_boundry(),n,o);
+  r["fn"]         = share_array(v->cp_fn(),n,o);
+  return r;
+}
+
+bp::tuple msc_view_canc(mscomplex_view_ptr_t v,int i)
+{
+  ENSURES(is_in_range(i,0,v->num_canc())) << "invalid canc "<< i <<"\n";
+  return bp::make_tuple(v->canc(i).first,v->canc(i).second);
+}
+
+bp::tuple msc_view_frange(mscomplex_view_ptr_t v)
+{
+  return bp::make_tuple(v->fmin(),v->fmax());
+}
+
+void wrap_mscomplex_view_t()
+{
+  class_<mscomplex_view_t,mscomplex_view_ptr_t>
+      ("mscomplex_view",
+       "Read only Morse-Smale complex in a file written by save_msc.\n"\
+       "The file is mmapped and only the parts that are asked for are read.",
+       no_init)
+      .def("__init__", make_constructor( &new_msc_view),
+           "ctor.. takes the file name")
+      .def("num_cp",&mscomplex_view_t::get_num_critpts,
+           "Number of Critical Points")
+      .def("fn",&mscomplex_view_t::fn,
+           "Function value at critical point i")
+      .def("index",&mscomplex_view_t::index,
+           "Morse index od critical point i")
+      .def("pair_idx",&mscomplex_view_t::pair_idx,
+           "Index of the cp that is paired with i (-1 if it is not paired)")
+      .def("is_boundry",&mscomplex_view_t::is_boundry,
+           "If the cp is on the boundary or not")
+      .def("vertid",&mscomplex_view_t::vertid,
+           "vertex id of maximal vertex of critical cell")
+      .def("cellid",&mscomplex_view_t::cellid,
+           "cell id of critical cell")
+      .def("num_canc",&mscomplex_view_t::num_canc,
+           "Number of cancellation pairs")
+      .def("has_gradient",&mscomplex_view_t::has_gradient,
+           "If the file holds the gradient (see mscomplex.load_gradient)")
+      .def("canc",&msc_view_canc,
+           "The ith cancellation pair")
+      .def("frange",&msc_view_frange,
+           "Range of function values")
+      .def("asc",&msc_view_conn<ASC>,
+           "int32 array of ascending cps connected to a given critical point i")
+      .def("des",&msc_view_conn<DES>,
+           "int32 array of descending cps connected to a given critical point i")
+      .def("asc_geom",&msc_view_geom<ASC>,
+           "Ascending manifold geometry of a given critical point i\n"\
+           "as an int32 array.. read in place from the file if not coded")
+      .def("des_geom",&msc_view_geom<DES>,
+           "Descending manifold geometry of a given critical point i\n"\
+           "as an int32 array.. read in place from the file if not coded")
+      .def("cp_table",&msc_view_cp_table,
+           "dict of per cp arrays, indexed by cp: cellid, vertid, pair_idx,\n"\
+           "index, is_boundry and fn. Read in place from the file.")
+      ;
+}
+
 /*****************************************************************************/
 /******** Define the pymstet module                                   ********/
 /*****************************************************************************/
 
 BOOST_PYTHON_MODULE(pymstri)
 {
-  numeric::array::set_module_and_type("numpy", "ndarray");
+  np::initialize();
 
   wrap_tet_cc_t();
 
   wrap_mscomplex_t();
 
+  wrap_mscomplex_view_t();
+
+  def("set_num_threads",&utl::set_num_threads,
+      "Set the number of threads used to compute the Morse-Smale complex\n"\
+      "Parameters:\n"\
+      "    n: number of threads (0 = all cores)\n");
+
+  def("get_num_threads",&utl::get_num_threads,
+      "Number of threads used to compute the Morse-Smale complex");
+
 }
 
 }/****************************************************************************/